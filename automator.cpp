@@ -33,6 +33,12 @@ Automator::Automator(QObject *parent) : QObject(parent)
     m_scanApprooved = false;
     m_entryMissing = false;
 
+    // Camera is only needed at full rate around pauses where dz is taken
+    m_idleCaptureRate = 5;
+    m_compensationPending = false;
+    m_snapshotPending = false;
+    m_requestedCaptureRate = requestedCaptureRate();
+
     //m_surfaceSpline = nullptr;
 }
 
@@ -121,6 +127,8 @@ void Automator::onMcStateChanged(RayReceiver::State s)
     if (!m_working) return;
 
     if (!m_cutModeEnabled && s == RayReceiver::Paused) {
+        m_compensationPending = true;
+        updateCaptureRate();
         if(m_mcs_x_check_state != m_mcs_x || m_mcs_y_check_state != m_mcs_y)
         {
             m_mcs_x_check_state = m_mcs_x;
@@ -134,8 +142,11 @@ void Automator::onMcStateChanged(RayReceiver::State s)
             m_compensatorOneShot = true;
         }
     }
-    if (!m_cutModeEnabled && s == RayReceiver::Playing)
+    if (!m_cutModeEnabled && s == RayReceiver::Playing) {
             m_compensatorOneShot = false;
+            m_compensationPending = false;
+            updateCaptureRate();
+    }
 }
 
 void Automator::onCameraFail()
@@ -148,6 +159,8 @@ void Automator::scanSnapshot(GcodePlayer::State s)
 {
     if (s == GcodePlayer::State::PausedM25)
     {
+        m_snapshotPending = true;
+        updateCaptureRate();
         QTimer::singleShot(1000, this, SLOT(m_scanSnapshot()));
     }
 }
@@ -217,6 +230,8 @@ void Automator::scanFinished(GcodePlayer::State s)
 
 void Automator::compensate()
 {
+    m_compensationPending = false;
+    updateCaptureRate();
     if (!m_working || m_cutModeEnabled)
         return;
     float compensated = compensate(m_lastdz);
@@ -731,13 +746,44 @@ void Automator::checkWorkingState()
     } else {
         m_working = false;
         m_state = Disabled;
+        m_compensationPending = false;
         emit stateChanged(m_state);
     }
+    updateCaptureRate();
+}
+
+void Automator::updateCaptureRate()
+{
+    float rate = requestedCaptureRate();
+    if (rate == m_requestedCaptureRate)
+        return;
+    m_requestedCaptureRate = rate;
+    emit captureRateRequested(rate);
+}
+
+float Automator::requestedCaptureRate() const
+{
+    if (m_compensationPending || m_snapshotPending)
+        return 0;
+    return m_idleCaptureRate;
+}
+
+float Automator::idleCaptureRate() const
+{
+    return m_idleCaptureRate;
+}
+
+void Automator::setIdleCaptureRate(float idleCaptureRate)
+{
+    m_idleCaptureRate = qMax(0.0f, idleCaptureRate);
+    updateCaptureRate();
 }
 
 void Automator::m_scanSnapshot()
 {
     float compensated = compensate(m_lastdz);
+    m_snapshotPending = false;
+    updateCaptureRate();
     if (compensated > 10) {
         m_message = "No entry in comp table";
         if (!scanSnapshotNumber) {
@@ -32,6 +32,7 @@ class Automator : public QObject
     Q_PROPERTY(float lastSentPower READ lastSentPower NOTIFY changePower)
     Q_PROPERTY(SurfaceModel *surfaceModel READ surfaceModel CONSTANT)
     Q_PROPERTY(State state READ state NOTIFY stateChanged)
+    Q_PROPERTY(float idleCaptureRate READ idleCaptureRate WRITE setIdleCaptureRate)
 public:
     explicit Automator(QObject *parent = nullptr);
     ~Automator();
@@ -81,6 +82,16 @@ public:
 
     float interpolateFromSurfaceScan(const SurfacePoint &point);
 
+    /**
+     * @brief idleCaptureRate Camera rate while no compensation or scan snapshot is pending, 0 for full rate
+     */
+    float idleCaptureRate() const;
+    void setIdleCaptureRate(float idleCaptureRate);
+    /**
+     * @brief requestedCaptureRate Rate Automator currently needs, 0 for full rate
+     */
+    float requestedCaptureRate() const;
+
 signals:
     void enabledChanged();
     void messageChanged();
@@ -92,6 +103,10 @@ signals:
     void stateChanged(State s);
     void scanStateChanged();
     void requestMissingEntry();
+    /**
+     * @brief captureRateRequested Emitted when Automator needs a different camera rate, 0 for full rate
+     */
+    void captureRateRequested(float fps);
 
 public slots:
     void ondzChanged(float dz);
@@ -109,6 +124,7 @@ public slots:
 
 private:
     void checkWorkingState();
+    void updateCaptureRate();
     bool m_working;
     float m_lastdz;
     bool m_lastdzValid;
@@ -138,6 +154,10 @@ private:
     SurfaceModel *m_surfaceModel;
     State m_state;
     RayReceiver::State m_lastMCState;
+    float m_idleCaptureRate;
+    float m_requestedCaptureRate;
+    bool m_compensationPending;
+    bool m_snapshotPending;
 
     //SPLINTER::DataTable m_samples;
     //SPLINTER::BSpline *m_surfaceSpline;
@@ -0,0 +1,393 @@
+#include "beamkernel.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BEAMKERNEL_X86
+#include <immintrin.h>
+#endif
+
+// NEON kernel lives in beamkernel_neon.cpp, the only file built with NEON enabled on 32-bit ARM.
+// This file is built without it, so the build defines BEAMKERNEL_NEON to dispatch there.
+#if !defined(BEAMKERNEL_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define BEAMKERNEL_NEON
+#endif
+#if defined(BEAMKERNEL_NEON) && defined(__linux__) && !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// Scalar reference must stay scalar, otherwise self test would compare vector code with vector code
+#if defined(__GNUC__) && !defined(__clang__)
+#define BEAMKERNEL_NO_VECTORIZE __attribute__((optimize("no-tree-vectorize")))
+#else
+#define BEAMKERNEL_NO_VECTORIZE
+#endif
+
+typedef quint32 (*MaskRowFunction)(const quint8 *hsv, int count, const BeamKernel::Thresholds &t, quint8 *masked);
+
+static inline quint8 maskedValue(const quint8 *hsv, const BeamKernel::Thresholds &t)
+{
+    quint8 h = hsv[0];
+    quint8 s = hsv[1];
+    quint8 v = hsv[2];
+    if (s < t.saturationFrom || s > t.saturationTo || v < t.valueFrom || v > t.valueTo)
+        return 0;
+    bool lowBand = h >= t.hueLowFrom && h <= t.hueLowTo;
+    bool highBand = h >= t.hueHighFrom && h <= t.hueHighTo;
+    return lowBand || highBand ? v : 0;
+}
+
+static inline quint8 dimmed(quint8 v)
+{
+    return v > 127 ? v - 127 : 0;
+}
+
+static inline void writeDebug(quint8 *debug, int col, quint8 v)
+{
+    debug[col * 3] = 0;
+    debug[col * 3 + 1] = 0;
+    debug[col * 3 + 2] = v;
+}
+
+BEAMKERNEL_NO_VECTORIZE
+static quint32 maskRowTail(const quint8 *hsv, int from, int count, const BeamKernel::Thresholds &t, quint8 *masked)
+{
+    quint32 sum = 0;
+    for (int i = from; i < count; ++i) {
+        quint8 v = maskedValue(hsv + i * 3, t);
+        sum += v;
+        if (masked)
+            masked[i] = v;
+    }
+    return sum;
+}
+
+BEAMKERNEL_NO_VECTORIZE
+quint32 BeamKernel::maskRowScalar(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked)
+{
+    return maskRowTail(hsv, 0, count, t, masked);
+}
+
+#ifdef BEAMKERNEL_X86
+// Splits 16 interleaved 3 byte pixels into planes with SSE2 unpacks only
+static inline void deinterleave16(const quint8 *ptr, __m128i &a, __m128i &b, __m128i &c)
+{
+    __m128i t00 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+    __m128i t01 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 16));
+    __m128i t02 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + 32));
+
+    __m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+    __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+    __m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+
+    __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+    __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+    __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+    __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+    __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+    __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+    a = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+    b = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+    c = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+}
+
+// Unsigned lo <= x <= hi, SSE2 has only signed byte compares
+static inline __m128i inRange16(__m128i x, __m128i lo, __m128i hi)
+{
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, lo), x),
+                         _mm_cmpeq_epi8(_mm_min_epu8(x, hi), x));
+}
+
+static quint32 maskRowSse2(const quint8 *hsv, int count, const BeamKernel::Thresholds &t, quint8 *masked)
+{
+    const __m128i hueLowFrom = _mm_set1_epi8(static_cast<char>(t.hueLowFrom));
+    const __m128i hueLowTo = _mm_set1_epi8(static_cast<char>(t.hueLowTo));
+    const __m128i hueHighFrom = _mm_set1_epi8(static_cast<char>(t.hueHighFrom));
+    const __m128i hueHighTo = _mm_set1_epi8(static_cast<char>(t.hueHighTo));
+    const __m128i saturationFrom = _mm_set1_epi8(static_cast<char>(t.saturationFrom));
+    const __m128i saturationTo = _mm_set1_epi8(static_cast<char>(t.saturationTo));
+    const __m128i valueFrom = _mm_set1_epi8(static_cast<char>(t.valueFrom));
+    const __m128i valueTo = _mm_set1_epi8(static_cast<char>(t.valueTo));
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i h, s, v;
+        deinterleave16(hsv + i * 3, h, s, v);
+        __m128i hue = _mm_or_si128(inRange16(h, hueLowFrom, hueLowTo), inRange16(h, hueHighFrom, hueHighTo));
+        __m128i mask = _mm_and_si128(hue, _mm_and_si128(inRange16(s, saturationFrom, saturationTo),
+                                                         inRange16(v, valueFrom, valueTo)));
+        __m128i mv = _mm_and_si128(mask, v);
+        if (masked)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(masked + i), mv);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(mv, zero));
+    }
+    quint32 sum = static_cast<quint32>(_mm_cvtsi128_si32(acc)) +
+                  static_cast<quint32>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc)));
+    return sum + maskRowTail(hsv, i, count, t, masked);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inRange32(__m256i x, __m256i lo, __m256i hi)
+{
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, lo), x),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(x, hi), x));
+}
+
+__attribute__((target("avx2")))
+static quint32 maskRowAvx2(const quint8 *hsv, int count, const BeamKernel::Thresholds &t, quint8 *masked)
+{
+    const __m256i hueLowFrom = _mm256_set1_epi8(static_cast<char>(t.hueLowFrom));
+    const __m256i hueLowTo = _mm256_set1_epi8(static_cast<char>(t.hueLowTo));
+    const __m256i hueHighFrom = _mm256_set1_epi8(static_cast<char>(t.hueHighFrom));
+    const __m256i hueHighTo = _mm256_set1_epi8(static_cast<char>(t.hueHighTo));
+    const __m256i saturationFrom = _mm256_set1_epi8(static_cast<char>(t.saturationFrom));
+    const __m256i saturationTo = _mm256_set1_epi8(static_cast<char>(t.saturationTo));
+    const __m256i valueFrom = _mm256_set1_epi8(static_cast<char>(t.valueFrom));
+    const __m256i valueTo = _mm256_set1_epi8(static_cast<char>(t.valueTo));
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m128i h0, s0, v0, h1, s1, v1;
+        deinterleave16(hsv + i * 3, h0, s0, v0);
+        deinterleave16(hsv + i * 3 + 48, h1, s1, v1);
+        __m256i h = _mm256_inserti128_si256(_mm256_castsi128_si256(h0), h1, 1);
+        __m256i s = _mm256_inserti128_si256(_mm256_castsi128_si256(s0), s1, 1);
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(v0), v1, 1);
+        __m256i hue = _mm256_or_si256(inRange32(h, hueLowFrom, hueLowTo), inRange32(h, hueHighFrom, hueHighTo));
+        __m256i mask = _mm256_and_si256(hue, _mm256_and_si256(inRange32(s, saturationFrom, saturationTo),
+                                                              inRange32(v, valueFrom, valueTo)));
+        __m256i mv = _mm256_and_si256(mask, v);
+        if (masked)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(masked + i), mv);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(mv, zero));
+    }
+    __m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    quint32 sum = static_cast<quint32>(_mm_cvtsi128_si32(acc128)) +
+                  static_cast<quint32>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc128, acc128)));
+    return sum + maskRowTail(hsv, i, count, t, masked);
+}
+#endif // BEAMKERNEL_X86
+
+struct MaskRowImplementation {
+    MaskRowFunction function;
+    const char *name;
+};
+
+enum { MaxMaskRowImplementations = 4 };
+
+// Every implementation this CPU can run, fastest first, scalar last
+static int supportedMaskRows(MaskRowImplementation *implementations)
+{
+    int count = 0;
+#ifdef BEAMKERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        implementations[count++] = MaskRowImplementation { maskRowAvx2, "avx2" };
+    if (__builtin_cpu_supports("sse2"))
+        implementations[count++] = MaskRowImplementation { maskRowSse2, "sse2" };
+#endif
+#ifdef BEAMKERNEL_NEON
+#if defined(__linux__) && !defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON)
+        implementations[count++] = MaskRowImplementation { BeamKernel::maskRowNeon, "neon" };
+#else
+    implementations[count++] = MaskRowImplementation { BeamKernel::maskRowNeon, "neon" };
+#endif
+#endif
+    implementations[count++] = MaskRowImplementation { BeamKernel::maskRowScalar, "scalar" };
+    return count;
+}
+
+static MaskRowImplementation selectMaskRow()
+{
+    MaskRowImplementation implementations[MaxMaskRowImplementations];
+    supportedMaskRows(implementations);
+    return implementations[0];
+}
+
+static MaskRowImplementation &maskRowImplementation()
+{
+    static MaskRowImplementation implementation = selectMaskRow();
+    return implementation;
+}
+
+quint32 BeamKernel::maskRow(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked)
+{
+    return maskRowImplementation().function(hsv, count, t, masked);
+}
+
+const char *BeamKernel::implementationName()
+{
+    return maskRowImplementation().name;
+}
+
+static bool testMaskRow(MaskRowFunction maskRow)
+{
+    enum { MaxCount = 211 };
+    quint8 hsv[MaxCount * 3];
+    quint8 expected[MaxCount];
+    quint8 actual[MaxCount];
+    quint32 seed = 12345;
+    auto next = [&seed]() -> quint8 {
+        seed = seed * 1103515245u + 12345u;
+        return static_cast<quint8>(seed >> 16);
+    };
+    for (int iteration = 0; iteration < 256; ++iteration) {
+        int count = iteration % MaxCount + 1;
+        for (int i = 0; i < count * 3; ++i)
+            hsv[i] = next();
+        for (int i = 0; i < count; ++i)
+            hsv[i * 3] %= 180;
+        BeamKernel::Thresholds t;
+        t.hueLowFrom = next() % 20;
+        t.hueLowTo = t.hueLowFrom + next() % 40;
+        t.hueHighFrom = 140 + next() % 30;
+        t.hueHighTo = t.hueHighFrom + next() % 40;
+        t.saturationFrom = next() % 128;
+        t.saturationTo = 128 + next() % 128;
+        t.valueFrom = next() % 128;
+        t.valueTo = 128 + next() % 128;
+        if (BeamKernel::maskRowScalar(hsv, count, t, expected) != maskRow(hsv, count, t, actual))
+            return false;
+        if (memcmp(expected, actual, count) != 0)
+            return false;
+        if (BeamKernel::maskRowScalar(hsv, count, t, nullptr) != maskRow(hsv, count, t, nullptr))
+            return false;
+    }
+    return true;
+}
+
+bool BeamKernel::selfTest()
+{
+    // Not only the dispatched one, a broken SSE2 kernel would otherwise show up only on CPUs without AVX2
+    MaskRowImplementation implementations[MaxMaskRowImplementations];
+    const int count = supportedMaskRows(implementations);
+    bool ok = true;
+    for (int i = 0; i < count; ++i) {
+        if (implementations[i].function != maskRowScalar)
+            ok = testMaskRow(implementations[i].function) && ok;
+    }
+    return ok;
+}
+
+void BeamKernel::useScalar()
+{
+    maskRowImplementation() = MaskRowImplementation { maskRowScalar, "scalar" };
+}
+
+// Masks [from, to) with the vector kernel in chunks and writes it to debug row, dimmed if asked
+static quint32 maskRowDebug(const quint8 *hsv, int from, int to, const BeamKernel::Thresholds &t, bool dim,
+                            quint8 *debug)
+{
+    enum { Chunk = 256 };
+    quint8 masked[Chunk];
+    quint32 sum = 0;
+    for (int col = from; col < to; col += Chunk) {
+        const int count = qMin<int>(Chunk, to - col);
+        const quint32 chunkSum = BeamKernel::maskRow(hsv + col * 3, count, t, masked);
+        if (!dim) {
+            sum += chunkSum;
+            for (int i = 0; i < count; ++i)
+                writeDebug(debug, col + i, masked[i]);
+            continue;
+        }
+        for (int i = 0; i < count; ++i) {
+            quint8 v = dimmed(masked[i]);
+            sum += v;
+            writeDebug(debug, col + i, v);
+        }
+    }
+    return sum;
+}
+
+quint32 BeamKernel::extractRow(const quint8 *hsv, int cols, const Thresholds &t, int colFrom, int colTo, quint8 *debug)
+{
+    colFrom = qBound(0, colFrom, cols);
+    colTo = qBound(colFrom, colTo, cols);
+    quint32 sum = 0;
+
+    if (!debug) {
+        if (colFrom < colTo) {
+            sum += dimmed(maskedValue(hsv + colFrom * 3, t));
+            sum += maskRow(hsv + (colFrom + 1) * 3, colTo - colFrom - 1, t, nullptr);
+        }
+        return sum;
+    }
+
+    maskRowDebug(hsv, 0, colFrom, t, true, debug);
+    if (colFrom < colTo) {
+        sum += maskRowDebug(hsv, colFrom, colFrom + 1, t, true, debug);
+        sum += maskRowDebug(hsv, colFrom + 1, colTo, t, false, debug);
+    }
+    maskRowDebug(hsv, colTo, cols, t, true, debug);
+    return sum;
+}
+
+static inline quint8 maskedLuma(const quint8 *ycr, int channels, const BeamKernel::ChromaThresholds &t)
+{
+    quint8 y = ycr[0];
+    if (y < t.valueFrom || y > t.valueTo)
+        return 0;
+    return channels == 1 || ycr[1] >= t.chromaRedFrom ? y : 0;
+}
+
+quint32 BeamKernel::extractRowYCr(const quint8 *ycr, int channels, int cols, const ChromaThresholds &t,
+                                  int colFrom, int colTo, quint8 *debug)
+{
+    colFrom = qBound(0, colFrom, cols);
+    colTo = qBound(colFrom, colTo, cols);
+    quint32 sum = 0;
+
+    if (!debug) {
+        if (colFrom < colTo)
+            sum += dimmed(maskedLuma(ycr + colFrom * channels, channels, t));
+        for (int col = colFrom + 1; col < colTo; ++col)
+            sum += maskedLuma(ycr + col * channels, channels, t);
+        return sum;
+    }
+
+    for (int col = 0; col < colFrom; ++col)
+        writeDebug(debug, col, dimmed(maskedLuma(ycr + col * channels, channels, t)));
+    if (colFrom < colTo) {
+        quint8 v = dimmed(maskedLuma(ycr + colFrom * channels, channels, t));
+        sum += v;
+        writeDebug(debug, colFrom, v);
+    }
+    for (int col = colFrom + 1; col < colTo; ++col) {
+        quint8 v = maskedLuma(ycr + col * channels, channels, t);
+        sum += v;
+        writeDebug(debug, col, v);
+    }
+    for (int col = colTo; col < cols; ++col)
+        writeDebug(debug, col, dimmed(maskedLuma(ycr + col * channels, channels, t)));
+    return sum;
+}
+
+void BeamKernel::yuyvToYCr(const quint8 *yuyv, int cols, quint8 *ycr)
+{
+    // Y0 U Y1 V -> Y0 V Y1 V
+    for (int col = 0; col + 1 < cols; col += 2) {
+        quint8 cr = yuyv[col * 2 + 3];
+        ycr[col * 2] = yuyv[col * 2];
+        ycr[col * 2 + 1] = cr;
+        ycr[col * 2 + 2] = yuyv[col * 2 + 2];
+        ycr[col * 2 + 3] = cr;
+    }
+    if (cols & 1) {
+        ycr[(cols - 1) * 2] = yuyv[(cols - 1) * 2];
+        ycr[(cols - 1) * 2 + 1] = 128;
+    }
+}
+
+void BeamKernel::nv12ToYCr(const quint8 *y, const quint8 *uv, int cols, quint8 *ycr)
+{
+    for (int col = 0; col < cols; ++col) {
+        ycr[col * 2] = y[col];
+        ycr[col * 2 + 1] = uv[(col & ~1) + 1];
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef BEAMKERNEL_H
+#define BEAMKERNEL_H
+
+#include <QtGlobal>
+
+namespace BeamKernel {
+
+/**
+ * @brief The Thresholds struct HSV limits of the red laser line, same meaning as LineDetector properties
+ */
+struct Thresholds {
+    quint8 hueLowFrom;
+    quint8 hueLowTo;
+    quint8 hueHighFrom;
+    quint8 hueHighTo;
+    quint8 saturationFrom;
+    quint8 saturationTo;
+    quint8 valueFrom;
+    quint8 valueTo;
+};
+
+/**
+ * @brief The ChromaThresholds struct Limits of the red laser line for frames captured in YUV or grey
+ */
+struct ChromaThresholds {
+    quint8 valueFrom;     ///< Y lower limit
+    quint8 valueTo;       ///< Y upper limit
+    quint8 chromaRedFrom; ///< Cr lower limit, not used for grey frames
+};
+
+/**
+ * @brief extractRow Masks V channel of one HSV row with both red hue bands and S/V limits and
+ * integrates it over [colFrom, colTo)
+ * Everything outside of (colFrom, colTo) is dimmed by 127, as the debug view always did, so the
+ * first column of the band contributes dimmed value to the sum.
+ * @param hsv Row in OpenCV 8-bit HSV layout (H 0..179)
+ * @param cols Row width in pixels
+ * @param t
+ * @param colFrom First integrated column
+ * @param colTo Integration end, exclusive
+ * @param debug Optional BGR row, receives masked V as red channel for the whole width
+ * @return Sum of masked V inside integration limits
+ */
+quint32 extractRow(const quint8 *hsv, int cols, const Thresholds &t, int colFrom, int colTo, quint8 *debug);
+
+/**
+ * @brief extractRowYCr Same as @ref extractRow() for rows of Y, Cr pairs or Y only, masked Y is integrated
+ * @param ycr Row of interleaved Y and Cr (channels 2) or Y (channels 1)
+ */
+quint32 extractRowYCr(const quint8 *ycr, int channels, int cols, const ChromaThresholds &t,
+                      int colFrom, int colTo, quint8 *debug);
+/**
+ * @brief yuyvToYCr Converts YUYV row to Y, Cr pairs, Cr is shared by every two pixels
+ */
+void yuyvToYCr(const quint8 *yuyv, int cols, quint8 *ycr);
+/**
+ * @brief nv12ToYCr Converts NV12 row to Y, Cr pairs
+ * @param y Luma row
+ * @param uv Interleaved chroma row of half resolution covering this luma row
+ */
+void nv12ToYCr(const quint8 *y, const quint8 *uv, int cols, quint8 *ycr);
+
+/**
+ * @brief maskRow Masks V channel of count HSV pixels and sums it
+ * Dispatches to AVX2, SSE2 or NEON implementation picked at runtime, all bit-exact with @ref maskRowScalar().
+ * @param masked Optional output, receives masked V
+ * @return Sum of masked V
+ */
+quint32 maskRow(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked);
+/**
+ * @brief maskRowScalar Reference implementation of @ref maskRow()
+ */
+quint32 maskRowScalar(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked);
+/**
+ * @brief maskRowNeon NEON implementation of @ref maskRow(), only built for ARM with NEON
+ * Lives in beamkernel_neon.cpp, the only file compiled with NEON enabled, call through @ref maskRow().
+ */
+quint32 maskRowNeon(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked);
+/**
+ * @brief implementationName Name of implementation used by @ref maskRow()
+ */
+const char *implementationName();
+/**
+ * @brief selfTest Compares every implementation this CPU supports with @ref maskRowScalar() on pseudo random rows
+ * @return true if results of all of them are identical
+ */
+bool selfTest();
+/**
+ * @brief useScalar Makes @ref maskRow() use scalar implementation
+ */
+void useScalar();
+
+} // namespace BeamKernel
+
+#endif // BEAMKERNEL_H
@@ -0,0 +1,41 @@
+#include "beamkernel.h"
+
+// Built with NEON enabled (-mfpu=neon on 32-bit ARM), nothing else in this file may run on CPUs without it.
+// BeamKernel dispatch calls it only after checking HWCAP_NEON.
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static inline uint8x16_t inRange16(uint8x16_t x, uint8x16_t lo, uint8x16_t hi)
+{
+    return vandq_u8(vcgeq_u8(x, lo), vcleq_u8(x, hi));
+}
+
+quint32 BeamKernel::maskRowNeon(const quint8 *hsv, int count, const Thresholds &t, quint8 *masked)
+{
+    const uint8x16_t hueLowFrom = vdupq_n_u8(t.hueLowFrom);
+    const uint8x16_t hueLowTo = vdupq_n_u8(t.hueLowTo);
+    const uint8x16_t hueHighFrom = vdupq_n_u8(t.hueHighFrom);
+    const uint8x16_t hueHighTo = vdupq_n_u8(t.hueHighTo);
+    const uint8x16_t saturationFrom = vdupq_n_u8(t.saturationFrom);
+    const uint8x16_t saturationTo = vdupq_n_u8(t.saturationTo);
+    const uint8x16_t valueFrom = vdupq_n_u8(t.valueFrom);
+    const uint8x16_t valueTo = vdupq_n_u8(t.valueTo);
+    uint32x4_t acc = vdupq_n_u32(0);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t px = vld3q_u8(hsv + i * 3);
+        uint8x16_t hue = vorrq_u8(inRange16(px.val[0], hueLowFrom, hueLowTo),
+                                  inRange16(px.val[0], hueHighFrom, hueHighTo));
+        uint8x16_t mask = vandq_u8(hue, vandq_u8(inRange16(px.val[1], saturationFrom, saturationTo),
+                                                 inRange16(px.val[2], valueFrom, valueTo)));
+        uint8x16_t mv = vandq_u8(mask, px.val[2]);
+        if (masked)
+            vst1q_u8(masked + i, mv);
+        acc = vpadalq_u16(acc, vpaddlq_u8(mv));
+    }
+    quint32 sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+                  vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    // Tail goes through the reference, compiled without NEON in beamkernel.cpp
+    return sum + maskRowScalar(hsv + i * 3, count - i, t, masked ? masked + i : nullptr);
+}
+#endif
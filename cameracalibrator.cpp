@@ -1,6 +1,7 @@
 #include <opencv2/opencv.hpp>
 
 #include <QDir>
+#include <QRunnable>
 
 #include "cameracalibrator.h"
 #include "capturecontroller.hpp"
@@ -10,10 +11,80 @@
 
 Q_LOGGING_CATEGORY(cameraCalibrator, "vhrd.vision.camera_calibrator");
 
+class CameraCalibrator::Task : public QRunnable
+{
+public:
+    Task(CameraCalibrator *calibrator, const QSharedPointer<Batch> &batch, int index,
+         const QString &file, const cv::Mat &frame) :
+        m_calibrator(calibrator), m_batch(batch), m_index(index), m_file(file), m_frame(frame)
+    {
+    }
+
+    void run() override
+    {
+        if (!m_batch->cancelled.load()) {
+            cv::Mat frame = m_frame;
+            if (!m_file.isEmpty())
+                frame = cv::imread(m_file.toStdString());
+            if (frame.empty())
+                qCWarning(cameraCalibrator) << "Empty picture" << m_file;
+            else if (!m_batch->cancelled.load())
+                findChessboard(frame, m_batch->boardSize, m_batch->results[m_index]);
+        }
+        m_batch->done.fetchAndAddOrdered(1);
+        // Calibrator waits for the pool before it is destroyed, so it is always alive here
+        QMetaObject::invokeMethod(m_calibrator, "onTaskFinished", Qt::QueuedConnection);
+    }
+
+private:
+    CameraCalibrator *m_calibrator;
+    QSharedPointer<Batch> m_batch;
+    int m_index;
+    QString m_file;
+    cv::Mat m_frame;
+};
+
+CameraCalibrator::Batch::Batch(int size, const cv::Size &boardSize) :
+    results(size), boardSize(boardSize), done(0), cancelled(0)
+{
+}
+
 CameraCalibrator::CameraCalibrator(CaptureController *captureController, QObject *parent) : QObject(parent),
     m_takePicture(false), m_captureController(captureController),
     m_horizontalCornersCount(9), m_verticalCornersCount(6)
 {
+    connect(m_captureController, &CaptureController::frameReady,
+            this,                &CameraCalibrator::onFrameReady);
+}
+
+CameraCalibrator::~CameraCalibrator()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+QString CameraCalibrator::captureSource() const
+{
+    return m_captureController->name();
+}
+
+void CameraCalibrator::setCaptureSource(const QString &name)
+{
+    CaptureController *captureController = CaptureController::find(name);
+    if (!captureController) {
+        qCWarning(cameraCalibrator) << "No capture source" << name;
+        return;
+    }
+    if (captureController == m_captureController)
+        return;
+    disconnect(m_captureController, &CaptureController::frameReady,
+               this,                &CameraCalibrator::onFrameReady);
+    m_captureController = captureController;
+    connect(m_captureController, &CaptureController::frameReady,
+            this,                &CameraCalibrator::onFrameReady);
+    clearPictures();
+    m_takePicture = false;
+    emit captureSourceChanged();
 }
 
 quint32 CameraCalibrator::horizontalCornersCount() const
@@ -24,7 +95,7 @@ quint32 CameraCalibrator::horizontalCornersCount() const
 void CameraCalibrator::setHorizontalCornersCount(quint32 count)
 {
     m_horizontalCornersCount = count;
-    m_pictures.clear();
+    clearPictures();
 }
 
 quint32 CameraCalibrator::verticalCornersCount() const
@@ -35,7 +106,17 @@ quint32 CameraCalibrator::verticalCornersCount() const
 void CameraCalibrator::setVerticalCornersCount(quint32 count)
 {
     m_verticalCornersCount = count;
-    m_pictures.clear();
+    clearPictures();
+}
+
+bool CameraCalibrator::busy() const
+{
+    return !m_batches.isEmpty();
+}
+
+int CameraCalibrator::pictureCount() const
+{
+    return m_pictures.size();
 }
 
 void CameraCalibrator::takePicture()
@@ -50,8 +131,26 @@ void CameraCalibrator::onFrameReady()
     m_takePicture = false;
 
     qCDebug(cameraCalibrator) << "Processing frame";
-    cv::Mat frame = m_captureController->frameCopy();
-    findChessboard(frame);
+    // Frame is searched on the pool after the slot is released, so it needs its own copy
+    FrameRef ref = m_captureController->latestFrame();
+    cv::Mat frame;
+    frameToBgr(ref.mat(), ref.info().format, frame);
+    if (ref.info().format == PixelFormat::BGR)
+        frame = frame.clone();
+    ref.reset();
+    start(QStringList(), frame);
+}
+
+void CameraCalibrator::cancel()
+{
+    if (m_batches.isEmpty())
+        return;
+    // Tasks not started yet return at once, running ones finish their picture and are ignored
+    foreach (const QSharedPointer<Batch> &batch, m_batches)
+        batch->cancelled.store(1);
+    m_batches.clear();
+    qCDebug(cameraCalibrator) << "Chessboard search cancelled";
+    emit busyChanged();
 }
 
 void CameraCalibrator::calibrate()
@@ -60,6 +159,8 @@ void CameraCalibrator::calibrate()
         qCWarning(cameraCalibrator) << "Not enough pictures for calibration";
         return;
     }
+    if (busy())
+        qCWarning(cameraCalibrator) << "Calibrating with" << m_pictures.size() << "pictures, search is still running";
     std::vector<cv::Point3f> points;
     for (quint32 i = 0; i < m_horizontalCornersCount; ++i) {
         for (quint32 j = 0; j < m_verticalCornersCount; ++j) {
@@ -132,13 +233,14 @@ void CameraCalibrator::loadPictures(const QString &fromFolder)
     QDir dir(fromFolder);
     QString absPath = dir.absolutePath();
     QStringList images = dir.entryList(QStringList() << "*.jpg" << "*.JPG", QDir::Files);
-    quint32 i = 0;
-    foreach (const QString &image, images) {
-        cv::Mat frame = cv::imread((absPath + "/" + image).toStdString());
-        qCDebug(cameraCalibrator) << "Loading" << i+1 << "of" << images.size() << ":" << !frame.empty();
-        findChessboard(frame);
-        i += 1;
+    if (images.isEmpty()) {
+        qCWarning(cameraCalibrator) << "No pictures in" << absPath;
+        return;
     }
+    QStringList files;
+    foreach (const QString &image, images)
+        files.append(absPath + "/" + image);
+    start(files);
 }
 
 void CameraCalibrator::saveCalibrationData(const QString &filename)
@@ -157,26 +259,81 @@ void CameraCalibrator::loadCalibrationData(const QString &filename)
     fs.release();
 }
 
-void CameraCalibrator::findChessboard(const cv::Mat &frame)
+void CameraCalibrator::onTaskFinished()
 {
-    if (frame.empty()) {
-        qCWarning(cameraCalibrator) << "empty frame";
+    // Batches are merged in the order they were started, pictures in the order of files
+    bool merged = false;
+    while (!m_batches.isEmpty() && m_batches.first()->done.load() == int(m_batches.first()->results.size())) {
+        QSharedPointer<Batch> batch = m_batches.takeFirst();
+        int found = 0;
+        for (const picture_t &p : batch->results) {
+            if (p.corners.empty())
+                continue;
+            m_pictures.append(p);
+            found += 1;
+        }
+        qCDebug(cameraCalibrator) << "Pattern found in" << found << "of" << batch->results.size() << "pictures";
+        if (found > 0) {
+            const picture_t &last = m_pictures.last();
+            cv::Mat shown = last.picture.clone();
+            cv::drawChessboardCorners(shown, batch->boardSize, last.corners, true);
+            CVMatSurfaceSource::imshow("second", shown);
+            emit picturesChanged();
+        }
+        emit finished(found, int(batch->results.size()));
+        merged = true;
     }
-    cv::Mat gray = cv::Mat(frame.rows, frame.cols, CV_8UC1);
-    cv::cvtColor(frame, gray, cv::COLOR_RGB2GRAY);
-    //CVMatSurfaceSource::imshow("second", gray);
 
-    auto board_size = cv::Size(m_verticalCornersCount, m_horizontalCornersCount);
-    std::vector<cv::Point2f> corners;
-    bool found = cv::findChessboardCorners(frame, board_size, corners, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FILTER_QUADS);
+    if (!m_batches.isEmpty()) {
+        int processed = 0, total = 0;
+        foreach (const QSharedPointer<Batch> &batch, m_batches) {
+            processed += batch->done.load();
+            total += int(batch->results.size());
+        }
+        emit progress(processed, total);
+    } else if (merged) {
+        emit busyChanged();
+    }
+}
 
-    if (found) {
-        qCDebug(cameraCalibrator) << "Pattern found!";
-        m_pictures.append(picture_t { frame.clone(), corners });
+void CameraCalibrator::start(const QStringList &files, const cv::Mat &frame)
+{
+    const int size = files.isEmpty() ? 1 : files.size();
+    QSharedPointer<Batch> batch(new Batch(size, boardSize()));
+    const bool wasBusy = busy();
+    m_batches.append(batch);
+    for (int i = 0; i < size; ++i)
+        m_pool.start(new Task(this, batch, i, files.value(i), frame));
+    qCDebug(cameraCalibrator) << "Searching chessboard in" << size << "pictures on" << m_pool.maxThreadCount() << "threads";
+    if (!wasBusy)
+        emit busyChanged();
+}
 
-        cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS | cv::TermCriteria::COUNT, 30, 0.1));
-        drawChessboardCorners(frame, board_size, corners, found);
-        CVMatSurfaceSource::imshow("second", frame);
+bool CameraCalibrator::findChessboard(const cv::Mat &frame, const cv::Size &boardSize, picture_t &result)
+{
+    cv::Mat gray;
+    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
 
-    }
+    std::vector<cv::Point2f> corners;
+    if (!cv::findChessboardCorners(gray, boardSize, corners, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FILTER_QUADS))
+        return false;
+    cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1),
+                     cv::TermCriteria(cv::TermCriteria::EPS | cv::TermCriteria::COUNT, 30, 0.1));
+    result.picture = frame;
+    result.corners = corners;
+    return true;
+}
+
+cv::Size CameraCalibrator::boardSize() const
+{
+    return cv::Size(m_verticalCornersCount, m_horizontalCornersCount);
+}
+
+void CameraCalibrator::clearPictures()
+{
+    cancel();
+    if (m_pictures.isEmpty())
+        return;
+    m_pictures.clear();
+    emit picturesChanged();
 }
@@ -5,27 +5,69 @@
 
 #include <QObject>
 #include <QLoggingCategory>
+#include <QSharedPointer>
+#include <QThreadPool>
 
 class CaptureController;
 
+/**
+ * @brief The CameraCalibrator class Collects chessboard pictures and computes undistort data
+ * Chessboard is searched on a thread pool, one task per picture, so loading a folder doesn't block GUI.
+ * Found pictures are added in file order when the whole batch completes, regardless of which task finishes first.
+ */
 class CameraCalibrator : public QObject
 {
     Q_OBJECT
     Q_PROPERTY(quint32 horizontalCornersCount READ horizontalCornersCount WRITE setHorizontalCornersCount)
     Q_PROPERTY(quint32 verticalCornersCount READ verticalCornersCount WRITE setVerticalCornersCount)
+    Q_PROPERTY(QString captureSource READ captureSource WRITE setCaptureSource NOTIFY captureSourceChanged)
+    Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
+    Q_PROPERTY(int pictureCount READ pictureCount NOTIFY picturesChanged)
 public:
     explicit CameraCalibrator(CaptureController *captureController, QObject *parent = nullptr);
+    ~CameraCalibrator();
+
+    /**
+     * @brief captureSource Name of CaptureController pictures are taken from and calibration is applied to
+     * Pictures taken from the previous source are dropped when it changes.
+     */
+    QString captureSource() const;
+    void setCaptureSource(const QString &name);
 
     quint32 horizontalCornersCount() const;
     void setHorizontalCornersCount(quint32 count);
     quint32 verticalCornersCount() const;
     void setVerticalCornersCount(quint32 count);
 
+    /**
+     * @brief busy True while pictures are loaded or searched for chessboard
+     */
+    bool busy() const;
+    /**
+     * @brief pictureCount Pictures with chessboard found, used by calibrate()
+     */
+    int pictureCount() const;
+
 signals:
+    void captureSourceChanged();
+    void busyChanged();
+    void picturesChanged();
+    /**
+     * @brief progress Pictures searched so far out of total of all running batches
+     */
+    void progress(int processed, int total);
+    /**
+     * @brief finished Batch started by loadPictures() or takePicture() is merged
+     */
+    void finished(int found, int processed);
 
 public slots:
     void takePicture();
     void onFrameReady();
+    /**
+     * @brief cancel Drops all running searches, pictures found already are kept
+     */
+    void cancel();
     void calibrate();
     void applyCalibrationData();
     void savePictures(const QString &toFolder);
@@ -33,14 +75,38 @@ public slots:
     void saveCalibrationData(const QString &filename);
     void loadCalibrationData(const QString &filename);
 
-private:
-    void findChessboard(const cv::Mat &frame);
+private slots:
+    void onTaskFinished();
 
+private:
     struct picture_t {
         cv::Mat picture;
         std::vector<cv::Point2f> corners;
     };
+    /**
+     * Pictures searched together, every task writes only its own result slot, corners stay empty if not found.
+     * Shared with tasks, so it outlives cancel() until the last task returns.
+     */
+    struct Batch {
+        Batch(int size, const cv::Size &boardSize);
+        std::vector<picture_t> results;
+        cv::Size boardSize;
+        QAtomicInt done;
+        QAtomicInt cancelled;
+    };
+    class Task;
+
+    /**
+     * @brief start Searches files, or frame if there are none, as one batch
+     */
+    void start(const QStringList &files, const cv::Mat &frame = cv::Mat());
+    static bool findChessboard(const cv::Mat &frame, const cv::Size &boardSize, picture_t &result);
+    cv::Size boardSize() const;
+    void clearPictures();
+
     QList<picture_t> m_pictures;
+    QList<QSharedPointer<Batch>> m_batches;
+    QThreadPool m_pool;
     bool m_takePicture;
     CaptureController *m_captureController;
 
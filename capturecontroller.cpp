@@ -1,108 +1,570 @@
 #include "capturecontroller.hpp"
 
 #include <QReadWriteLock>
+#include <QFile>
 #include <QDebug>
 
 #include <opencv2/opencv.hpp>
 
-//remove
 #include "cvmatsurfacesource.hpp"
+#include "latencystatistics.h"
+#include "mjpegclient.h"
+#include "threadtuning.h"
 #include <QTime>
+#include <QUrl>
+
+struct CaptureControllerRegistry {
+    QHash<QString, CaptureController *> controllers;
+    QStringList names;
+    QMutex lock;
+};
+Q_GLOBAL_STATIC(CaptureControllerRegistry, g_captureControllers)
+
+Q_LOGGING_CATEGORY(capture, "vhrd.vision.capture")
 
 CaptureWorker::CaptureWorker(const QString &device, CaptureController *captureController, QObject *parent) :
-    QObject(parent), m_device(device), m_captureController(captureController), m_loopRunning(true), m_useUndistort(false)
+    QObject(parent), m_device(device), m_capture(nullptr), m_mjpeg(nullptr), m_captureController(captureController),
+    m_surface(captureController->surface()), m_recordLatency(captureController->recordLatency()),
+    m_format(static_cast<PixelFormat>(captureController->captureFormat())), m_rawType(-1),
+    m_loopRunning(true), m_displayMapRevision(0)
 {
 }
 
 void CaptureWorker::stop()
 {
     m_loopRunning = false;
+    // Stream reads block, they are cancelled so the thread quits before stop() would terminate it
+    QMutexLocker lock(&m_mjpegLock);
+    if (m_mjpeg)
+        m_mjpeg->cancel();
 }
 
-void CaptureWorker::doWork()
+bool CaptureWorker::open()
 {
     bool ok = false;
     int deviceId = m_device.toInt(&ok);
     if (ok) {
         m_capture = new cv::VideoCapture(deviceId);
+        if (m_capture->isOpened() && m_format != PixelFormat::BGR) {
+            // Ask for native format and raw buffers, driver conversion to BGR is what we want to avoid
+            static const char *fourcc[] = {"BGR3", "YUYV", "NV12", "GREY"};
+            const char *f = fourcc[static_cast<int>(m_format)];
+            const int requested = cv::VideoWriter::fourcc(f[0], f[1], f[2], f[3]);
+            // Some backends report success and keep their format, e.g. MJPG, whose buffers vary in size
+            m_capture->set(cv::CAP_PROP_FOURCC, requested);
+            if (static_cast<int>(m_capture->get(cv::CAP_PROP_FOURCC)) != requested) {
+                qWarning() << "Camera doesn't provide" << f << "frames, falling back to BGR";
+                m_format = PixelFormat::BGR;
+            } else {
+                m_capture->set(cv::CAP_PROP_CONVERT_RGB, 0);
+                m_size = cv::Size(static_cast<int>(m_capture->get(cv::CAP_PROP_FRAME_WIDTH)),
+                                  static_cast<int>(m_capture->get(cv::CAP_PROP_FRAME_HEIGHT)));
+            }
+        }
+    } else if (QFile::exists(m_device)) {
+        m_format = PixelFormat::BGR;
+        m_capture = new cv::VideoCapture(m_device.toStdString());
     } else {
-        m_capture = new cv::VideoCapture("http://192.168.88.4:8080/?action=stream");
+        // Streams are read natively, so frames can be decoded at reduced size or skipped
+        QUrl url(m_device);
+        if (url.scheme() != "http")
+            url = QUrl(m_captureController->streamUrl());
+        {
+            QMutexLocker lock(&m_mjpegLock);
+            m_mjpeg = new MjpegClient;
+            if (!m_loopRunning)
+                m_mjpeg->cancel();
+        }
+        if (!m_mjpeg->open(url)) {
+            qWarning() << "Can't open stream" << url << m_mjpeg->errorString();
+            return false;
+        }
+        return true;
     }
-    if (!m_capture->isOpened()) {
+    return m_capture->isOpened();
+}
+
+bool CaptureWorker::grab()
+{
+    if (m_mjpeg)
+        return m_mjpeg->readFrame(m_jpeg);
+    return m_capture->grab();
+}
+
+bool CaptureWorker::retrieve(cv::Mat &frame, PixelFormat &format)
+{
+    if (!m_mjpeg) {
+        if (m_format == PixelFormat::BGR) {
+            m_capture->retrieve(frame);
+            format = PixelFormat::BGR;
+            return !frame.empty();
+        }
+        // Slot was reshaped to the frame layout by rawFormat(), in driver shape again retrieve() reuses its memory
+        if (m_rawType >= 0 && !frame.empty() && frame.isContinuous() && frame.depth() == CV_MAT_DEPTH(m_rawType) &&
+                frame.total() * frame.elemSize() == static_cast<size_t>(m_rawSize.area()) * CV_ELEM_SIZE(m_rawType))
+            frame = frame.reshape(CV_MAT_CN(m_rawType), m_rawSize.height);
+        m_capture->retrieve(frame);
+        m_rawSize = frame.size();
+        m_rawType = frame.type();
+        format = rawFormat(frame);
+        return !frame.empty();
+    }
+    int scale;
+    QRectF region;
+    {
+        QMutexLocker lock(&m_captureController->m_decodeLock);
+        scale = m_captureController->m_decodeScale;
+        region = m_captureController->m_decodeRegion;
+    }
+    // Only grey is native for JPEG, YUYV and NV12 requests get BGR
+    format = m_format == PixelFormat::Grey ? PixelFormat::Grey : PixelFormat::BGR;
+    if (!MjpegClient::decode(m_jpeg, frame, scale, region, format == PixelFormat::Grey)) {
+        qWarning() << "Can't decode MJPEG frame of" << m_jpeg.size() << "bytes";
+        frame.release(); // broken frame is skipped, it doesn't end the stream
+    }
+    return true;
+}
+
+PixelFormat CaptureWorker::rawFormat(cv::Mat &frame) const
+{
+    // With conversion off backends return the driver buffer as is, often a single row of bytes,
+    // layout is told by its size
+    if (frame.empty() || !frame.isContinuous())
+        return PixelFormat::BGR;
+    const size_t bytes = frame.total() * frame.elemSize();
+    const size_t pixels = static_cast<size_t>(m_size.area());
+    if (frame.type() == CV_8UC3 || bytes == pixels * 3)
+        return PixelFormat::BGR;
+    if (bytes == pixels * 2) {
+        frame = frame.reshape(2, m_size.height);
+        return PixelFormat::YUYV;
+    }
+    if (bytes == pixels * 3 / 2) {
+        frame = frame.reshape(1, m_size.height * 3 / 2);
+        return PixelFormat::NV12;
+    }
+    if (bytes == pixels) {
+        frame = frame.reshape(1, m_size.height);
+        return PixelFormat::Grey;
+    }
+    qWarning() << "Unknown raw frame layout" << frame.cols << frame.rows << frame.type() << "for" << m_size.width << m_size.height;
+    frame.release();
+    return PixelFormat::BGR;
+}
+
+void CaptureWorker::doWork()
+{
+    ThreadTuning::apply("capture_" + m_captureController->name());
+    if (!open()) {
         qWarning() << "Can't capture" << m_device;
+        delete m_capture;
+        m_capture = nullptr;
+        {
+            QMutexLocker lock(&m_mjpegLock);
+            delete m_mjpeg;
+            m_mjpeg = nullptr;
+        }
         m_captureController->setStatus(CaptureController::Status::Failed);
         emit workDone();
         return;
     }
-    bool isVideoFile = static_cast<int>(m_capture->get(cv::CAP_PROP_FRAME_COUNT)) > 0;
+    bool isVideoFile = m_capture && static_cast<int>(m_capture->get(cv::CAP_PROP_FRAME_COUNT)) > 0;
     unsigned long sleepBetweenFrames = 0;
     if (isVideoFile)
         sleepBetweenFrames = static_cast<unsigned long>((1.0 / m_capture->get(cv::CAP_PROP_FPS)) * 1000000);
     m_captureController->setStatus(CaptureController::Status::Started);
+    quint64 sequence = 0;
+    quint64 published = 0;
+    qint64 lastRetrieved = 0;
     while(m_loopRunning) {
-        if (!m_capture->grab()) {
-            m_captureController->setStatus(CaptureController::Status::EofOrDisconnected);
+        CaptureController::ReplayMode mode = m_captureController->replayMode();
+        if (isVideoFile && published != 0 && mode != CaptureController::ReplayMode::RealTime)
+            waitForConsumers(published, mode == CaptureController::ReplayMode::LockStep);
+
+        qint64 grabStart = LatencyStatistics::now();
+        if (!grab()) {
+            if (m_loopRunning) // not a cancelled stream read
+                m_captureController->setStatus(CaptureController::Status::EofOrDisconnected);
             break;
         }
-        m_captureController->m_lock->lockForWrite();
-        m_capture->retrieve(m_frame);
-        if (m_frame.empty()) { // last frame of video
+        FrameInfo info;
+        info.timestamp = LatencyStatistics::now();
+        if (m_recordLatency)
+            LatencyStatistics::record(LatencyStatistics::Grab, info.timestamp - grabStart);
+        m_captureController->m_framesGrabbed.fetchAndAddRelaxed(1);
+        // Nobody asked for this frame, it isn't numbered so consumers don't count it as dropped.
+        // 1/8 of interval tolerates camera jitter, otherwise every other frame would be lost at limits close to camera rate.
+        const qint64 minInterval = m_captureController->m_minFrameInterval.load();
+        if (!isVideoFile && minInterval > 0 && info.timestamp - lastRetrieved < minInterval - minInterval / 8) {
+            m_captureController->m_framesThrottled.fetchAndAddRelaxed(1);
+            continue;
+        }
+        info.sequence = ++sequence;
+        // Decoding is the most expensive part for streams, don't decode frames nobody would take
+        if (m_mjpeg && m_captureController->consumersBehind(published)) {
+            m_captureController->m_framesSkipped.fetchAndAddRelaxed(1);
+            continue;
+        }
+        // Retrieve straight into a free pool slot, consumers still reading older frames are not disturbed
+        cv::Mat *slot = m_captureController->m_framePool.acquire();
+        cv::Mat &frame = slot ? *slot : m_scratch;
+        if (!retrieve(frame, info.format)) { // last frame of video
             m_captureController->setStatus(CaptureController::Status::EofOrDisconnected);
             break;
         }
+        if (frame.empty())
+            continue;
+        lastRetrieved = info.timestamp;
+        if (m_capture)
+            info.cameraTimestamp = m_capture->get(cv::CAP_PROP_POS_MSEC);
+        if (m_recordLatency)
+            LatencyStatistics::recordSince(LatencyStatistics::Retrieve, info.timestamp);
 
-        QReadLocker lock(m_captureController->m_undistortLock);
-        if (m_useUndistort) {
-            cv::Mat undistorted(m_frame.rows, m_frame.cols, m_frame.type());
-            cv::undistort(m_frame, undistorted, m_intrinsic, m_distCoeffs);
-            m_frame = undistorted;
+        if (slot) {
+            m_captureController->m_framePool.publish(info);
+            m_captureController->m_framesPublished.fetchAndAddRelaxed(1);
+            published = info.sequence;
+            emit frameReady();
+            if (CVMatSurfaceSource::wantsFrame(m_surface)) {
+                qint64 displayStart = LatencyStatistics::now();
+                showFrame(frame, info.format);
+                if (m_recordLatency)
+                    LatencyStatistics::recordSince(LatencyStatistics::Display, displayStart);
+            }
         }
-        lock.unlock();
-
-        m_captureController->m_lock->unlock();
-
-        emit frameReady();
-        CVMatSurfaceSource::imshow("main", m_frame);
 
 
-        //qDebug() << "imshow" << m_frame.cols << m_frame.rows << m_frame.size;
+        //qDebug() << "imshow" << frame.cols << frame.rows << frame.size;
 
         //qDebug() << QTime::currentTime();
 
-        if(isVideoFile)
+        if(isVideoFile && mode == CaptureController::ReplayMode::RealTime)
             QThread::usleep(sleepBetweenFrames);
     }
     delete m_capture;
+    m_capture = nullptr;
+    {
+        QMutexLocker lock(&m_mjpegLock);
+        delete m_mjpeg;
+        m_mjpeg = nullptr;
+    }
     emit workDone();
 }
 
-CaptureController::CaptureController(QObject *parent) :
-    QObject(parent), m_worker(nullptr), m_lock(nullptr), m_status(Status::Stopped)
+void CaptureWorker::waitForConsumers(quint64 sequence, bool acknowledged)
+{
+    QMutexLocker lock(&m_captureController->m_consumersLock);
+    while (m_loopRunning && m_captureController->replayMode() != CaptureController::ReplayMode::RealTime) {
+        bool ready = true;
+        foreach (const CaptureController::Consumer &c, m_captureController->m_consumers) {
+            if ((acknowledged ? c.acknowledged : c.lastSequence) < sequence) {
+                ready = false;
+                break;
+            }
+        }
+        if (ready)
+            return;
+        // Timeout only to notice stop(), mode changes wake it up
+        m_captureController->m_consumersCondition.wait(&m_captureController->m_consumersLock, 100);
+    }
+}
+
+void CaptureWorker::showFrame(const cv::Mat &raw, PixelFormat format)
+{
+    // Only the view needs BGR, converted here instead of by the driver for every frame
+    frameToBgr(raw, format, m_displayBgr);
+    const cv::Mat &frame = m_displayBgr;
+    quint32 revision = m_captureController->undistortRevision();
+    if (revision != m_displayMapRevision || frame.size() != m_displayMapSize) {
+        cv::Mat intrinsic;
+        cv::Mat distCoeffs;
+        m_displayMapRevision = m_captureController->undistortData(intrinsic, distCoeffs);
+        m_displayMapSize = frame.size();
+        if (intrinsic.empty()) {
+            m_displayMap1.release();
+            m_displayMap2.release();
+        } else {
+            cv::initUndistortRectifyMap(intrinsic, distCoeffs, cv::Mat(), intrinsic, m_displayMapSize,
+                                        CV_16SC2, m_displayMap1, m_displayMap2);
+        }
+    }
+    if (m_displayMap1.empty()) {
+        CVMatSurfaceSource::imshow(m_surface, frame);
+        return;
+    }
+    cv::remap(frame, m_displayFrame, m_displayMap1, m_displayMap2, cv::INTER_LINEAR);
+    CVMatSurfaceSource::imshow(m_surface, m_displayFrame);
+}
+
+CaptureController::CaptureController(const QString &name, QObject *parent) :
+    QObject(parent), m_worker(nullptr), m_framesGrabbed(0), m_framesPublished(0), m_framesSkipped(0),
+    m_framesThrottled(0), m_minFrameInterval(0), m_name(name), m_surface(name), m_recordLatency(true),
+    m_streamUrl("http://192.168.88.4:8080/?action=stream"), m_decodeScale(1), m_captureFormat(CaptureFormat::BGR),
+    m_captureRate(0),
+    m_replayMode(static_cast<int>(ReplayMode::RealTime)), m_undistortRevision(0), m_status(Status::Stopped)
 {
     m_undistortLock = new QReadWriteLock;
+
+    CaptureControllerRegistry *d = g_captureControllers;
+    QMutexLocker lock(&d->lock);
+    if (d->controllers.contains(name))
+        qWarning() << "Capture source" << name << "already exists";
+    else
+        d->controllers.insert(name, this);
+    d->names.append(name);
 }
 
 CaptureController::~CaptureController()
 {
     stop();
+    CaptureControllerRegistry *d = g_captureControllers;
+    if (d) {
+        QMutexLocker lock(&d->lock);
+        if (d->controllers.value(m_name) == this)
+            d->controllers.remove(m_name);
+        d->names.removeOne(m_name);
+    }
+    delete m_undistortLock;
+}
+
+CaptureController *CaptureController::find(const QString &name)
+{
+    CaptureControllerRegistry *d = g_captureControllers;
+    QMutexLocker lock(&d->lock);
+    return d->controllers.value(name);
+}
+
+QStringList CaptureController::names()
+{
+    CaptureControllerRegistry *d = g_captureControllers;
+    QMutexLocker lock(&d->lock);
+    return d->names;
+}
+
+QString CaptureController::name() const
+{
+    return m_name;
+}
+
+QString CaptureController::surface() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_surface;
+}
+
+void CaptureController::setSurface(const QString &surface)
+{
+    QMutexLocker lock(&m_decodeLock);
+    m_surface = surface;
+}
+
+bool CaptureController::recordLatency() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_recordLatency;
+}
+
+void CaptureController::setRecordLatency(bool recordLatency)
+{
+    QMutexLocker lock(&m_decodeLock);
+    m_recordLatency = recordLatency;
+}
+
+FrameRef CaptureController::latestFrame() const
+{
+    return m_framePool.latest();
+}
+
+quint64 CaptureController::lastSequence() const
+{
+    return m_framePool.lastSequence();
+}
+
+bool CaptureController::injectFrame(const cv::Mat &frame, const FrameInfo &info)
+{
+    // Pool has a single producer, capture worker is the one while it exists
+    if (m_worker)
+        return false;
+    cv::Mat *slot = m_framePool.acquire();
+    if (!slot)
+        return false;
+    frame.copyTo(*slot);
+    m_framePool.publish(info);
+    m_framesPublished.fetchAndAddRelaxed(1);
+    emit frameReady();
+    return true;
 }
 
-const cv::Mat CaptureController::frameRef() const
+int CaptureController::registerConsumer(const QString &name)
 {
-    if (!m_worker)
-        return cv::Mat();
-    QReadLocker lock(m_lock);
-    return m_worker->m_frame;
+    QMutexLocker lock(&m_consumersLock);
+    Consumer c;
+    c.name = name;
+    c.consumed = 0;
+    c.dropped = 0;
+    c.repeated = 0;
+    c.lastSequence = 0;
+    c.acknowledged = 0;
+    m_consumers.append(c);
+    return m_consumers.size() - 1;
+}
+
+void CaptureController::frameConsumed(int consumer, const FrameInfo &info)
+{
+    QMutexLocker lock(&m_consumersLock);
+    if (consumer < 0 || consumer >= m_consumers.size())
+        return;
+    Consumer &c = m_consumers[consumer];
+    if (info.sequence <= c.lastSequence) {
+        c.repeated++;
+        return;
+    }
+    c.consumed++;
+    c.dropped += info.sequence - c.lastSequence - 1;
+    c.lastSequence = info.sequence;
+    m_consumersCondition.wakeAll();
+}
+
+void CaptureController::acknowledgeFrame(int consumer, quint64 sequence)
+{
+    QMutexLocker lock(&m_consumersLock);
+    if (consumer < 0 || consumer >= m_consumers.size())
+        return;
+    m_consumers[consumer].acknowledged = qMax(m_consumers[consumer].acknowledged, sequence);
+    m_consumersCondition.wakeAll();
+}
+
+QVariantMap CaptureController::statistics() const
+{
+    QVariantMap stats;
+    stats["grabbed"] = m_framesGrabbed.load();
+    stats["published"] = m_framesPublished.load();
+    stats["starved"] = m_framePool.starved();
+    stats["skipped"] = m_framesSkipped.load();
+    stats["throttled"] = m_framesThrottled.load();
+    QVariantList consumers;
+    QMutexLocker lock(&m_consumersLock);
+    foreach (const Consumer &c, m_consumers) {
+        QVariantMap consumer;
+        consumer["name"] = c.name;
+        consumer["consumed"] = c.consumed;
+        consumer["dropped"] = c.dropped;
+        consumer["repeated"] = c.repeated;
+        consumer["lastSequence"] = c.lastSequence;
+        consumers.append(consumer);
+    }
+    stats["consumers"] = consumers;
+    return stats;
+}
+
+bool CaptureController::consumersBehind(quint64 sequence) const
+{
+    QMutexLocker lock(&m_consumersLock);
+    foreach (const Consumer &c, m_consumers) {
+        if (c.lastSequence < sequence)
+            return true;
+    }
+    return false;
+}
+
+QString CaptureController::streamUrl() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_streamUrl;
+}
+
+void CaptureController::setStreamUrl(const QString &streamUrl)
+{
+    QMutexLocker lock(&m_decodeLock);
+    m_streamUrl = streamUrl;
+}
+
+int CaptureController::decodeScale() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_decodeScale;
+}
+
+void CaptureController::setDecodeScale(int decodeScale)
+{
+    if (decodeScale != 1 && decodeScale != 2 && decodeScale != 4 && decodeScale != 8) {
+        qWarning() << "Unsupported decode scale" << decodeScale;
+        return;
+    }
+    QMutexLocker lock(&m_decodeLock);
+    m_decodeScale = decodeScale;
 }
 
-cv::Mat CaptureController::frameCopy() const
+QRectF CaptureController::decodeRegion() const
 {
-    if (!m_worker)
-        return cv::Mat();
-    QReadLocker lock(m_lock);
-    cv::Mat frame;
-    m_worker->m_frame.copyTo(frame);
-    return frame;
+    QMutexLocker lock(&m_decodeLock);
+    return m_decodeRegion;
+}
+
+void CaptureController::setDecodeRegion(const QRectF &decodeRegion)
+{
+    QMutexLocker lock(&m_decodeLock);
+    m_decodeRegion = decodeRegion.intersected(QRectF(0, 0, 1, 1));
+}
+
+CaptureController::CaptureFormat CaptureController::captureFormat() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_captureFormat;
+}
+
+void CaptureController::setCaptureFormat(CaptureController::CaptureFormat captureFormat)
+{
+    QMutexLocker lock(&m_decodeLock);
+    m_captureFormat = captureFormat;
+}
+
+void CaptureController::setRequestedRate(const QString &requester, float fps)
+{
+    float rate = -1;
+    {
+        QMutexLocker lock(&m_decodeLock);
+        if (fps < 0)
+            m_requestedRates.remove(requester);
+        else
+            m_requestedRates.insert(requester, fps);
+        foreach (float requested, m_requestedRates) {
+            if (requested == 0) {
+                rate = 0;
+                break;
+            }
+            rate = qMax(rate, requested);
+        }
+        rate = qMax(rate, 0.0f);
+        if (rate == m_captureRate)
+            return;
+        m_captureRate = rate;
+        m_minFrameInterval = rate > 0 ? static_cast<qint64>(1e9 / rate) : 0;
+    }
+    qCDebug(capture) << "Capture" << m_name << "rate" << (rate > 0 ? QString::number(rate) : QString("unlimited"));
+    emit captureRateChanged();
+}
+
+float CaptureController::captureRate() const
+{
+    QMutexLocker lock(&m_decodeLock);
+    return m_captureRate;
+}
+
+void CaptureController::resetCounters()
+{
+    m_framesGrabbed = 0;
+    m_framesPublished = 0;
+    m_framesSkipped = 0;
+    m_framesThrottled = 0;
+    QMutexLocker lock(&m_consumersLock);
+    for (int i = 0; i < m_consumers.size(); ++i) {
+        m_consumers[i].consumed = 0;
+        m_consumers[i].dropped = 0;
+        m_consumers[i].repeated = 0;
+        m_consumers[i].lastSequence = 0;
+        m_consumers[i].acknowledged = 0;
+    }
 }
 
 CaptureController::Status CaptureController::status() const
@@ -110,16 +572,40 @@ CaptureController::Status CaptureController::status() const
     return m_status;
 }
 
-void CaptureController::enableUndistort(const cv::Mat &intrinsic, const cv::Mat &distCoeffs)
+CaptureController::ReplayMode CaptureController::replayMode() const
 {
-    if (m_status != Status::Started) {
-        qWarning() << "Can't enable undistort before capture is started";
+    return static_cast<ReplayMode>(m_replayMode.load());
+}
+
+void CaptureController::setReplayMode(CaptureController::ReplayMode mode)
+{
+    if (replayMode() == mode)
         return;
-    }
+    m_replayMode = static_cast<int>(mode);
+    // Let waiting capture re-check the mode
+    m_consumersCondition.wakeAll();
+    emit replayModeChanged();
+}
+
+void CaptureController::enableUndistort(const cv::Mat &intrinsic, const cv::Mat &distCoeffs)
+{
     QWriteLocker lock(m_undistortLock);
-    m_worker->m_intrinsic = intrinsic;
-    m_worker->m_distCoeffs = distCoeffs;
-    m_worker->m_useUndistort = true;
+    m_intrinsic = intrinsic.clone();
+    m_distCoeffs = distCoeffs.clone();
+    m_undistortRevision.fetchAndAddOrdered(1);
+}
+
+quint32 CaptureController::undistortData(cv::Mat &intrinsic, cv::Mat &distCoeffs) const
+{
+    QReadLocker lock(m_undistortLock);
+    intrinsic = m_intrinsic;
+    distCoeffs = m_distCoeffs;
+    return m_undistortRevision.load();
+}
+
+quint32 CaptureController::undistortRevision() const
+{
+    return m_undistortRevision.load();
 }
 
 void CaptureController::start(const QString &device)
@@ -131,12 +617,13 @@ void CaptureController::start(const QString &device)
         return;
     }
     setStatus(Status::Starting);
-    m_lock = new QReadWriteLock;
+    resetCounters();
     m_worker = new CaptureWorker(device, this, nullptr);
     m_worker->moveToThread(&m_workerThread);
     connect(&m_workerThread, &QThread::started, m_worker, &CaptureWorker::doWork);
 //    connect(&m_workerThread, &QThread::finished, this, &CaptureController::stop);
-    connect(m_worker, &CaptureWorker::frameReady, this, &CaptureController::frameReady);
+    // Emitted from capture thread, so consumers can pick how they want to receive it
+    connect(m_worker, &CaptureWorker::frameReady, this, &CaptureController::frameReady, Qt::DirectConnection);
     connect(m_worker, &CaptureWorker::workDone, this, &CaptureController::stop);
     m_workerThread.start();
 }
@@ -145,7 +632,7 @@ void CaptureController::stop()
 {
     if (m_status == Status::Stopped)
         return;
-    qDebug() << "Capture is stopping from" << m_status << "state ...";
+    qDebug() << "Capture" << m_name << "is stopping from" << m_status << "state ...";
 
     disconnect(m_worker, &CaptureWorker::frameReady, this, &CaptureController::frameReady);
     m_worker->stop();
@@ -156,8 +643,8 @@ void CaptureController::stop()
     }
     delete m_worker;
     m_worker = nullptr;
-    delete m_lock;
-    m_lock = nullptr;
+    m_framePool.clear();
+    qDebug() << "Capture" << m_name << "stopped, frames:" << statistics();
     setStatus(Status::Stopped);
 }
 
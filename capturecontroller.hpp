@@ -3,14 +3,26 @@
 
 #include <QObject>
 #include <QThread>
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVariantMap>
+#include <QStringList>
+#include <QHash>
+#include <QRectF>
+#include <QVector>
+#include <QLoggingCategory>
 #include <opencv2/core.hpp>
 
+#include "framepool.h"
+
 namespace cv {
 class VideoCapture;
 }
 
 class QReadWriteLock;
 class CaptureController;
+class MjpegClient;
 class CaptureWorker : public QObject
 {
     Q_OBJECT
@@ -30,26 +42,125 @@ public slots:
 
 private:
     friend class CaptureController;
+    void showFrame(const cv::Mat &frame, PixelFormat format);
+    void waitForConsumers(quint64 sequence, bool acknowledged);
+    bool open();
+    bool grab();
+    bool retrieve(cv::Mat &frame, PixelFormat &format);
+    PixelFormat rawFormat(cv::Mat &frame) const;
+
     QString m_device;
     cv::VideoCapture *m_capture;
+    MjpegClient *m_mjpeg;
+    QMutex m_mjpegLock; ///< Guards m_mjpeg pointer, stop() cancels the stream from another thread
+    QByteArray m_jpeg;
     CaptureController *m_captureController;
-    cv::Mat m_frame;
+    QString m_surface;
+    bool m_recordLatency;
+    PixelFormat m_format;
+    cv::Size m_size;
+    cv::Size m_rawSize; ///< Driver buffer shape, pool slots are reshaped back to it before retrieve
+    int m_rawType;
+    cv::Mat m_scratch;
     bool m_loopRunning;
-    bool m_useUndistort;
-    cv::Mat m_intrinsic;
-    cv::Mat m_distCoeffs;
+    cv::Mat m_displayMap1;
+    cv::Mat m_displayMap2;
+    cv::Mat m_displayFrame;
+    cv::Mat m_displayBgr;
+    cv::Size m_displayMapSize;
+    quint32 m_displayMapRevision;
 };
 
+/**
+ * @brief The CaptureController class One capture source (camera, file or stream) on its own thread
+ * Every instance has its own frame pool, undistortion data and consumers, instances are found by name,
+ * so several cameras can run side by side without sharing anything but the CPU.
+ */
 class CaptureController : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(QString name READ name CONSTANT)
+    Q_PROPERTY(QString surface READ surface WRITE setSurface)
+    Q_PROPERTY(bool recordLatency READ recordLatency WRITE setRecordLatency)
     Q_PROPERTY(Status status READ status NOTIFY statusChanged)
+    Q_PROPERTY(float captureRate READ captureRate NOTIFY captureRateChanged)
+    Q_PROPERTY(ReplayMode replayMode READ replayMode WRITE setReplayMode NOTIFY replayModeChanged)
+    Q_PROPERTY(QString streamUrl READ streamUrl WRITE setStreamUrl)
+    Q_PROPERTY(int decodeScale READ decodeScale WRITE setDecodeScale)
+    Q_PROPERTY(QRectF decodeRegion READ decodeRegion WRITE setDecodeRegion)
+    Q_PROPERTY(CaptureFormat captureFormat READ captureFormat WRITE setCaptureFormat)
 public:
-    explicit CaptureController(QObject *parent = nullptr);
+    /**
+     * @param name Unique name, the first instance of a name is the one @ref find() returns
+     */
+    explicit CaptureController(const QString &name = QStringLiteral("main"), QObject *parent = nullptr);
     ~CaptureController();
 
-    const cv::Mat frameRef() const;
-    cv::Mat frameCopy() const;
+    /**
+     * @brief find Thread safe lookup of capture source by name
+     * @return nullptr if there is no such source
+     */
+    static CaptureController *find(const QString &name);
+    /**
+     * @brief names All capture sources, in creation order
+     */
+    static QStringList names();
+
+    QString name() const;
+    /**
+     * @brief surface CVMatSurfaceSource frames are shown on, same as name by default, applied on next start()
+     */
+    QString surface() const;
+    void setSurface(const QString &surface);
+    /**
+     * @brief recordLatency Report Grab, Retrieve and Display stages to LatencyStatistics, applied on next start()
+     * Statistics describe the beam pipeline, auxiliary cameras should have it off.
+     */
+    bool recordLatency() const;
+    void setRecordLatency(bool recordLatency);
+
+    /**
+     * @brief latestFrame Handle to the newest frame, no pixels are copied
+     * Release it as soon as possible, capture can only reuse slots nobody holds.
+     * @return Null handle if capture is not running
+     */
+    FrameRef latestFrame() const;
+    /**
+     * @brief lastSequence Sequence number of the newest published frame, thread safe
+     */
+    quint64 lastSequence() const;
+    /**
+     * @brief injectFrame Publishes frame from another source (session playback) as if it was captured
+     * Only while capture is stopped, frame is copied into the pool and frameReady() is emitted from caller thread.
+     * @return false if capture is running or all slots are held by consumers
+     */
+    bool injectFrame(const cv::Mat &frame, const FrameInfo &info);
+
+    /**
+     * @brief registerConsumer Adds consumer to frame accounting
+     * @return Id for @ref frameConsumed()
+     */
+    int registerConsumer(const QString &name);
+    /**
+     * @brief frameConsumed Reports that consumer processed frame, thread safe
+     * Frames skipped since previous reported one are counted as dropped for this consumer.
+     */
+    void frameConsumed(int consumer, const FrameInfo &info);
+    /**
+     * @brief acknowledgeFrame Reports that consumer is completely done with frame, thread safe
+     * Releases next frame in LockStep replay mode.
+     */
+    void acknowledgeFrame(int consumer, quint64 sequence);
+    /**
+     * @brief statistics Frame counters since last start
+     * @return grabbed, published, starved, skipped, throttled and consumers list with name, consumed, dropped, repeated
+     * and lastSequence
+     */
+    Q_INVOKABLE QVariantMap statistics() const;
+    /**
+     * @brief resetCounters Clears frame counters, done on every start() and when playback seeks
+     */
+    Q_INVOKABLE void resetCounters();
 
     /**
      * @brief The Status enum
@@ -64,26 +175,137 @@ public:
     Q_ENUM(Status)
     Status status() const;
 
+    /**
+     * @brief The ReplayMode enum Pacing of video files, cameras always run at their own rate
+     */
+    enum class ReplayMode {
+        RealTime,    ///< Sleep 1/fps between frames
+        FreeRunning, ///< Grab next frame as soon as every registered consumer took the previous one
+        LockStep     ///< Grab next frame only after every registered consumer acknowledged the previous one
+    };
+    Q_ENUM(ReplayMode)
+    ReplayMode replayMode() const;
+    void setReplayMode(ReplayMode mode);
+
+    /**
+     * @brief streamUrl MJPEG stream opened by start() when device is neither camera index, file nor URL
+     */
+    QString streamUrl() const;
+    void setStreamUrl(const QString &streamUrl);
+    /**
+     * @brief decodeScale 1, 2, 4 or 8, MJPEG frames are decoded at 1/scale resolution
+     * Calibration data must be taken at the same scale and region.
+     */
+    int decodeScale() const;
+    void setDecodeScale(int decodeScale);
+    /**
+     * @brief decodeRegion Normalized part of MJPEG frames to publish, empty for whole frame
+     */
+    QRectF decodeRegion() const;
+    void setDecodeRegion(const QRectF &decodeRegion);
+
+    /**
+     * @brief The CaptureFormat enum Pixel format requested from cameras, same values as @ref PixelFormat
+     */
+    enum class CaptureFormat {
+        BGR,  ///< Driver converts to BGR
+        YUYV, ///< Native YUYV 4:2:2, no conversion
+        NV12, ///< Native NV12 4:2:0, no conversion
+        Grey  ///< Native Y8 from mono cameras, grey JPEG decode for streams
+    };
+    Q_ENUM(CaptureFormat)
+    /**
+     * @brief captureFormat Applied on next start(), cameras not providing the format fall back to BGR
+     * Published frames carry their actual format in @ref FrameInfo::format, video files are always BGR.
+     */
+    CaptureFormat captureFormat() const;
+    void setCaptureFormat(CaptureFormat captureFormat);
+
+    /**
+     * @brief setRequestedRate Declares frame rate requester needs, thread safe
+     * Cameras and streams are throttled to the highest declared rate: frames over it are still grabbed,
+     * so driver buffers don't go stale, but not retrieved, decoded or published. Video files are not throttled.
+     * @param fps 0 asks for full rate, which wins over any limit, negative withdraws the request
+     */
+    void setRequestedRate(const QString &requester, float fps);
+    /**
+     * @brief captureRate Effective rate limit, 0 when capture runs at full rate
+     */
+    float captureRate() const;
+
+    /**
+     * @brief enableUndistort Sets camera calibration data
+     * Published frames stay distorted, consumers build their own remap tables (combined with other
+     * transforms they need) from @ref undistortData() and rebuild them when @ref undistortRevision() changes.
+     */
     void enableUndistort(const cv::Mat &intrinsic, const cv::Mat &distCoeffs);
+    /**
+     * @brief undistortData Copies current calibration data
+     * @return Revision of data, intrinsic and distCoeffs are left empty if undistort wasn't enabled
+     */
+    quint32 undistortData(cv::Mat &intrinsic, cv::Mat &distCoeffs) const;
+    /**
+     * @brief undistortRevision Changes every time @ref enableUndistort() is called
+     */
+    quint32 undistortRevision() const;
 
 public slots:
     void start(const QString &device);
     void stop();
 signals:
     void statusChanged(Status s);
+    void replayModeChanged();
+    void captureRateChanged();
+    /**
+     * @brief frameReady Emitted from capture thread, default connections are queued into receiver thread
+     */
     void frameReady();
     void cameraFail();
-    //void statisticsReady(QVariant ?
 
 private:
     friend class CaptureWorker;
     CaptureWorker* m_worker;
     QThread m_workerThread;
-    mutable QReadWriteLock* m_lock;
+    FramePool m_framePool;
+    QAtomicInteger<quint32> m_framesGrabbed;
+    QAtomicInteger<quint32> m_framesPublished;
+    QAtomicInteger<quint32> m_framesSkipped;
+    QAtomicInteger<quint32> m_framesThrottled;
+    QAtomicInteger<qint64> m_minFrameInterval;
+    bool consumersBehind(quint64 sequence) const;
+
+    const QString m_name;
+    mutable QMutex m_decodeLock;
+    QString m_surface;
+    bool m_recordLatency;
+    QString m_streamUrl;
+    int m_decodeScale;
+    QRectF m_decodeRegion;
+    CaptureFormat m_captureFormat;
+    QHash<QString, float> m_requestedRates;
+    float m_captureRate;
+
+    struct Consumer {
+        QString name;
+        quint32 consumed;
+        quint32 dropped;
+        quint32 repeated;
+        quint64 lastSequence;
+        quint64 acknowledged;
+    };
+    QVector<Consumer> m_consumers;
+    mutable QMutex m_consumersLock;
+    QWaitCondition m_consumersCondition;
+    QAtomicInt m_replayMode;
     mutable QReadWriteLock* m_undistortLock;
+    cv::Mat m_intrinsic;
+    cv::Mat m_distCoeffs;
+    QAtomicInteger<quint32> m_undistortRevision;
 
     void setStatus(Status status);
     Status m_status;
 };
 
+Q_DECLARE_LOGGING_CATEGORY(capture)
+
 #endif // CAPTURECONTROLLER_HPP
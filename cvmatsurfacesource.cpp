@@ -1,23 +1,71 @@
 #include "cvmatsurfacesource.hpp"
 
 #include <QAbstractVideoSurface>
+#include <QAbstractVideoBuffer>
 #include <QThread>
+#include <QMutex>
+#include <QElapsedTimer>
 #include <QDebug>
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
-Q_DECLARE_METATYPE(cv::Mat)
-
 struct CVMatSurfaceSourcePrivate {
-    CVMatSurfaceSourcePrivate() {}
+    CVMatSurfaceSourcePrivate() { clock.start(); }
     ~CVMatSurfaceSourcePrivate() {}
     QHash<QString, CVMatSurfaceSource *> sources;
+    QMutex lock;
+    QElapsedTimer clock;
 };
 Q_GLOBAL_STATIC(CVMatSurfaceSourcePrivate, g_sources)
 
+Q_LOGGING_CATEGORY(videoSurface, "vhrd.vision.surface")
+
+/**
+ * @brief The MatVideoBuffer class Video buffer over memory owned by a cv::Mat, always mapped
+ * Mat reference keeps memory alive as long as any QVideoFrame copy uses it, even after pool moved on.
+ */
+class MatVideoBuffer : public QAbstractVideoBuffer
+{
+public:
+    MatVideoBuffer(const cv::Mat &storage, int bytesPerLine, int height) :
+        QAbstractVideoBuffer(NoHandle), m_storage(storage), m_bytesPerLine(bytesPerLine), m_height(height),
+        m_mapMode(NotMapped)
+    {
+    }
+
+    MapMode mapMode() const override
+    {
+        return m_mapMode;
+    }
+
+    uchar *map(MapMode mode, int *numBytes, int *bytesPerLine) override
+    {
+        m_mapMode = mode;
+        if (numBytes)
+            *numBytes = m_bytesPerLine * m_height;
+        if (bytesPerLine)
+            *bytesPerLine = m_bytesPerLine;
+        return m_storage.data;
+    }
+
+    void unmap() override
+    {
+        m_mapMode = NotMapped;
+    }
+
+private:
+    cv::Mat m_storage;
+    int m_bytesPerLine;
+    int m_height;
+    MapMode m_mapMode;
+};
+
 CVMatSurfaceSource::CVMatSurfaceSource(QObject *parent) : QObject(parent),
-    m_surface(nullptr), m_videoFrame(nullptr)
+    m_surface(nullptr), m_nextFrame(0),
+    m_active(true), m_maxFps(30), m_lastFrameTime(0),
+    m_hasPending(false), m_presentQueued(false), m_framesPresented(0), m_framesCoalesced(0),
+    m_presentFailed(false)
 {
 }
 
@@ -26,6 +74,7 @@ CVMatSurfaceSource::~CVMatSurfaceSource()
     stopSurface();
     CVMatSurfaceSourcePrivate *d = g_sources;
     if (d) {
+        QMutexLocker lock(&d->lock);
         d->sources.remove(m_name);
     }
 }
@@ -37,9 +86,32 @@ QAbstractVideoSurface *CVMatSurfaceSource::videoSurface() const
 
 void CVMatSurfaceSource::setVideoSurface(QAbstractVideoSurface *surface)
 {
-    if (m_surface && m_surface->isActive())
-        m_surface->stop();
-    m_surface = surface;
+    if (m_surface) {
+        if (m_surface->isActive())
+            m_surface->stop();
+        disconnect(m_surface, &QAbstractVideoSurface::supportedFormatsChanged,
+                   this,      &CVMatSurfaceSource::updateSupportedFormats);
+    }
+    {
+        // wantsFrame() reads it from capture and detector threads under the registry lock
+        CVMatSurfaceSourcePrivate *d = g_sources;
+        QMutexLocker lock(d ? &d->lock : nullptr);
+        m_surface = surface;
+    }
+    // Frame format depends on surface, next present starts it
+    m_format = QVideoSurfaceFormat();
+    if (m_surface) {
+        connect(m_surface, &QAbstractVideoSurface::supportedFormatsChanged,
+                this,      &CVMatSurfaceSource::updateSupportedFormats);
+    }
+    updateSupportedFormats();
+}
+
+void CVMatSurfaceSource::updateSupportedFormats()
+{
+    m_supportedFormats.clear();
+    if (m_surface)
+        m_supportedFormats = m_surface->supportedPixelFormats(QAbstractVideoBuffer::NoHandle);
 }
 
 void CVMatSurfaceSource::imshow(const cv::Mat &mat)
@@ -49,46 +121,98 @@ void CVMatSurfaceSource::imshow(const cv::Mat &mat)
     if (mat.empty())
         return;
     if (QThread::currentThread() != this->thread()) {
-        QVariant matVariant = QVariant::fromValue(mat.clone());
-        QMetaObject::invokeMethod(this, "imshowFromVariant", Qt::QueuedConnection, Q_ARG(QVariant, matVariant));
+        // Memory stays bounded by two frames and GUI shows the newest one however slow it is
+        {
+            QMutexLocker lock(&m_pendingLock);
+            if (m_hasPending)
+                m_framesCoalesced.fetchAndAddRelaxed(1);
+            mat.copyTo(m_pending);
+            m_hasPending = true;
+            if (m_presentQueued)
+                return;
+            m_presentQueued = true;
+        }
+        QMetaObject::invokeMethod(this, "presentPending", Qt::QueuedConnection);
         return;
     }
-    if (!m_videoFrame) {
-        createVideoFrame(mat);
-    }
-    if (matHasChanged(mat)) {
-        if (m_videoFrame->isMapped())
-            m_videoFrame->unmap();
-        delete m_videoFrame;
-        createVideoFrame(mat);
-    }
-    cv::Mat matFromSurface = cv::Mat(m_videoFrame->size().height(),
-                                     m_videoFrame->size().width(),
-                                     CV_8UC4, m_videoFrame->bits());
-    if (mat.channels() == 3) {
-        cv::cvtColor(mat, matFromSurface, cv::COLOR_RGB2RGBA);
-    } else if (mat.channels() == 1) {
-        cv::cvtColor(mat, matFromSurface, cv::COLOR_GRAY2RGBA);
-    } else {
+    present(mat);
+}
+
+void CVMatSurfaceSource::presentPending()
+{
+    {
+        QMutexLocker lock(&m_pendingLock);
+        m_presentQueued = false;
+        if (!m_hasPending)
+            return;
+        // Buffers are swapped, not released, so producers copy into already allocated memory
+        cv::swap(m_pending, m_presenting);
+        m_hasPending = false;
+    }
+    if (m_surface)
+        present(m_presenting);
+}
+
+void CVMatSurfaceSource::present(const cv::Mat &mat)
+{
+    if (mat.channels() != 3 && mat.channels() != 1) {
         qDebug() << "Wrong channel count";
         return;
     }
-    if (!m_surface->present(*m_videoFrame)) {
-        qDebug() << "Surface present() failed" << m_surface->error();
+    const QSize sourceSize(mat.cols, mat.rows);
+    if (sourceSize != m_sourceSize) {
+        m_sourceSize = sourceSize;
+        emit dimensionsChanged();
     }
-}
+    // Surface is restarted only when presented size or format changes
+    const QSize size = presentedSize(sourceSize);
+    const QVideoFrame::PixelFormat pixelFormat = pixelFormatFor(mat.channels());
+    const bool native = pixelFormat == QVideoFrame::Format_BGR24 || pixelFormat == QVideoFrame::Format_Y8;
+    const int type = native || pixelFormat == QVideoFrame::Format_RGB24 ? mat.type() : CV_8UC4;
+    cv::Mat matFromSurface = nextFrame(size, pixelFormat, type);
 
-void CVMatSurfaceSource::imshowFromVariant(const QVariant &matVariant)
-{
-    cv::Mat mat = matVariant.value<cv::Mat>();
-    imshow(mat);
+    // Downscale first, so conversion only touches displayed pixels. Native formats are scaled straight into the frame.
+    const cv::Mat *source = &mat;
+    if (size != sourceSize) {
+        if (native) {
+            cv::resize(mat, matFromSurface, matFromSurface.size(), 0, 0, cv::INTER_AREA);
+            source = nullptr;
+        } else {
+            cv::resize(mat, m_scaled, cv::Size(size.width(), size.height()), 0, 0, cv::INTER_AREA);
+            source = &m_scaled;
+        }
+    }
+    if (source) {
+        if (native)
+            source->copyTo(matFromSurface);
+        else if (pixelFormat == QVideoFrame::Format_RGB24)
+            cv::cvtColor(*source, matFromSurface, cv::COLOR_BGR2RGB);
+        else if (source->channels() == 3)
+            cv::cvtColor(*source, matFromSurface, cv::COLOR_BGR2BGRA); // RGB32 and ARGB32 are B, G, R, A in memory
+        else
+            cv::cvtColor(*source, matFromSurface, cv::COLOR_GRAY2BGRA);
+    }
+    const QVideoFrame &frame = m_frames[m_nextFrame].frame;
+    m_nextFrame = (m_nextFrame + 1) % FramePoolSize;
+    if (!m_surface->present(frame)) {
+        // Surface that refuses one frame refuses all following ones, it would log on every frame
+        if (!m_presentFailed)
+            qCDebug(videoSurface) << m_name << "surface present() failed" << m_surface->error();
+        m_presentFailed = true;
+        return;
+    }
+    m_presentFailed = false;
+    m_framesPresented.fetchAndAddRelaxed(1);
+    emit countersChanged();
 }
 
 void CVMatSurfaceSource::imshow(const QString &surfaceName, const cv::Mat &mat)
 {
     CVMatSurfaceSourcePrivate *d = g_sources;
     if (d) {
+        QMutexLocker lock(&d->lock);
         CVMatSurfaceSource *source = d->sources.value(surfaceName, nullptr);
+        lock.unlock();
         if (source)
             source->imshow(mat);
         else
@@ -96,30 +220,83 @@ void CVMatSurfaceSource::imshow(const QString &surfaceName, const cv::Mat &mat)
     }
 }
 
+bool CVMatSurfaceSource::wantsFrame(const QString &surfaceName)
+{
+    CVMatSurfaceSourcePrivate *d = g_sources;
+    if (!d)
+        return false;
+    QMutexLocker lock(&d->lock);
+    CVMatSurfaceSource *source = d->sources.value(surfaceName, nullptr);
+    if (!source || !source->m_surface || !source->m_active)
+        return false;
+    qint64 now = d->clock.nsecsElapsed();
+    if (source->m_maxFps > 0 && source->m_lastFrameTime != 0 &&
+            now - source->m_lastFrameTime < static_cast<qint64>(1e9 / source->m_maxFps))
+        return false;
+    source->m_lastFrameTime = now;
+    return true;
+}
+
 void CVMatSurfaceSource::stopSurface()
 {
     if (m_surface && m_surface->isActive())
         m_surface->stop();
 }
 
-void CVMatSurfaceSource::createVideoFrame(const cv::Mat &mat)
+cv::Mat CVMatSurfaceSource::nextFrame(const QSize &size, QVideoFrame::PixelFormat pixelFormat, int type)
+{
+    const QVideoSurfaceFormat format(size, pixelFormat);
+    if (format != m_format || !m_surface->isActive()) {
+        if (m_surface->isActive())
+            m_surface->stop();
+        m_format = format;
+        if (!m_surface->start(m_format))
+            qWarning() << "Surface doesn't accept" << m_format << m_surface->error();
+    }
+
+    const int bytesPerLine = (size.width() * CV_ELEM_SIZE(type) + 3) & ~3;
+    PooledFrame &pooled = m_frames[m_nextFrame];
+    if (pooled.frame.size() != size || pooled.frame.pixelFormat() != pixelFormat) {
+        // Memory is allocated only when frames grow, frames holding the old storage keep it alive
+        const size_t bytes = static_cast<size_t>(bytesPerLine) * size.height();
+        if (pooled.storage.total() < bytes)
+            pooled.storage.create(1, static_cast<int>(bytes), CV_8UC1);
+        pooled.frame = QVideoFrame(new MatVideoBuffer(pooled.storage, bytesPerLine, size.height()), size, pixelFormat);
+    }
+    return cv::Mat(size.height(), size.width(), type, pooled.storage.data, bytesPerLine);
+}
+
+QVideoFrame::PixelFormat CVMatSurfaceSource::pixelFormatFor(int channels) const
 {
-    m_videoFrame = new QVideoFrame(mat.rows * mat.cols * 4,
-                                   QSize(mat.cols, mat.rows),
-                                   mat.cols * 4,
-                                   QVideoFrame::Format_ARGB32);
-    m_format = QVideoSurfaceFormat(m_videoFrame->size(), m_videoFrame->pixelFormat());
-    m_surface->start(m_format);
-    if (!m_videoFrame->map(QAbstractVideoBuffer::ReadOnly)) {
-        qWarning() << "QVideoFrame::map() failed";
+    // Formats matching OpenCV layout are copied as is, the rest needs one conversion pass
+    static const QVideoFrame::PixelFormat colorFormats[] = {
+        QVideoFrame::Format_BGR24, QVideoFrame::Format_RGB24, QVideoFrame::Format_RGB32
+    };
+    static const QVideoFrame::PixelFormat greyFormats[] = {
+        QVideoFrame::Format_Y8, QVideoFrame::Format_RGB32
+    };
+    if (channels == 3) {
+        for (QVideoFrame::PixelFormat f : colorFormats) {
+            if (m_supportedFormats.contains(f))
+                return f;
+        }
+    } else {
+        for (QVideoFrame::PixelFormat f : greyFormats) {
+            if (m_supportedFormats.contains(f))
+                return f;
+        }
     }
-    emit dimensionsChanged();
+    return QVideoFrame::Format_ARGB32;
 }
 
-bool CVMatSurfaceSource::matHasChanged(const cv::Mat &mat) const
+QSize CVMatSurfaceSource::presentedSize(const QSize &sourceSize) const
 {
-    return m_videoFrame->size().width() != mat.cols ||
-           m_videoFrame->size().height() != mat.rows;
+    if (m_displaySize.isEmpty())
+        return sourceSize;
+    QSize size = sourceSize.scaled(m_displaySize, Qt::KeepAspectRatio);
+    if (size.width() >= sourceSize.width() || size.isEmpty())
+        return sourceSize;
+    return size;
 }
 
 QString CVMatSurfaceSource::name() const
@@ -129,22 +306,76 @@ QString CVMatSurfaceSource::name() const
 
 quint32 CVMatSurfaceSource::width() const
 {
-    if (!m_format.isValid())
-        return 0;
-    return m_format.frameWidth();
+    return m_sourceSize.width();
 }
 
 quint32 CVMatSurfaceSource::height() const
 {
-    if (!m_format.isValid())
-        return 0;
-    return m_format.frameHeight();
+    return m_sourceSize.height();
+}
+
+QSize CVMatSurfaceSource::displaySize() const
+{
+    return m_displaySize;
+}
+
+void CVMatSurfaceSource::setDisplaySize(const QSize &displaySize)
+{
+    if (m_displaySize == displaySize)
+        return;
+    m_displaySize = displaySize;
+    emit displaySizeChanged();
+}
+
+bool CVMatSurfaceSource::active() const
+{
+    return m_active;
+}
+
+void CVMatSurfaceSource::setActive(bool active)
+{
+    if (m_active == active)
+        return;
+    {
+        CVMatSurfaceSourcePrivate *d = g_sources;
+        QMutexLocker lock(d ? &d->lock : nullptr);
+        m_active = active;
+    }
+    emit activeChanged();
+}
+
+qreal CVMatSurfaceSource::maxFps() const
+{
+    return m_maxFps;
+}
+
+void CVMatSurfaceSource::setMaxFps(qreal maxFps)
+{
+    if (m_maxFps == maxFps)
+        return;
+    {
+        CVMatSurfaceSourcePrivate *d = g_sources;
+        QMutexLocker lock(d ? &d->lock : nullptr);
+        m_maxFps = maxFps;
+    }
+    emit maxFpsChanged();
+}
+
+quint32 CVMatSurfaceSource::framesPresented() const
+{
+    return m_framesPresented.load();
+}
+
+quint32 CVMatSurfaceSource::framesCoalesced() const
+{
+    return m_framesCoalesced.load();
 }
 
 void CVMatSurfaceSource::setName(const QString &name)
 {
     CVMatSurfaceSourcePrivate *d = g_sources;
     if (d) {
+        QMutexLocker lock(&d->lock);
         d->sources.remove(m_name);
         d->sources.insert(name, this);
     }
@@ -2,7 +2,11 @@
 #define CVMATSURFACESOURCE_H
 
 #include <QObject>
+#include <QMutex>
+#include <QAtomicInteger>
 #include <QVideoSurfaceFormat>
+#include <QSize>
+#include <QLoggingCategory>
 
 #include <opencv2/core.hpp>
 
@@ -16,6 +20,11 @@ class CVMatSurfaceSource : public QObject
     Q_PROPERTY(QString name READ name WRITE setName)
     Q_PROPERTY(quint32 width READ width NOTIFY dimensionsChanged)
     Q_PROPERTY(quint32 height READ height NOTIFY dimensionsChanged)
+    Q_PROPERTY(QSize displaySize READ displaySize WRITE setDisplaySize NOTIFY displaySizeChanged)
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(qreal maxFps READ maxFps WRITE setMaxFps NOTIFY maxFpsChanged)
+    Q_PROPERTY(quint32 framesPresented READ framesPresented NOTIFY countersChanged)
+    Q_PROPERTY(quint32 framesCoalesced READ framesCoalesced NOTIFY countersChanged)
 public:
     explicit CVMatSurfaceSource(QObject *parent = nullptr);
     ~CVMatSurfaceSource();
@@ -25,6 +34,8 @@ public:
 
     /**
      * @brief imshow Sends mat to video surface setted by @ref setVideoSurface
+     * From other threads mat is copied into a single pending slot and at most one present is queued,
+     * a frame not yet presented is overwritten by the newer one (coalesced).
      * @param mat
      */
     void imshow(const cv::Mat &mat);
@@ -34,6 +45,13 @@ public:
      * @param mat
      */
     static void imshow(const QString &surfaceName, const cv::Mat &mat);
+    /**
+     * @brief wantsFrame Checks if surface with such name exists, is attached, active and it's time for next frame
+     * Producers should skip building visualization entirely if it returns false. Thread safe.
+     * @param surfaceName
+     * @return true if frame will be displayed, next call will respect @ref maxFps() from this moment
+     */
+    static bool wantsFrame(const QString &surfaceName);
 
     /**
      * @brief setName Sets name and mades this object accessible through static imshow()
@@ -42,23 +60,89 @@ public:
     void setName(const QString &name);
     QString name() const;
 
+    /**
+     * @brief width Width of frames given to imshow(), not of the presented ones
+     */
     quint32 width() const;
     quint32 height() const;
 
+    /**
+     * @brief displaySize Size in pixels the frames are drawn at, frames are downscaled to fit it before
+     * conversion and presentation, never upscaled. Empty for presenting frames at their own size.
+     */
+    QSize displaySize() const;
+    void setDisplaySize(const QSize &displaySize);
+
+    /**
+     * @brief active Set to false when displaying item is hidden, producers will stop rendering frames
+     */
+    bool active() const;
+    void setActive(bool active);
+
+    /**
+     * @brief maxFps Display rate limit, 0 for no limit
+     */
+    qreal maxFps() const;
+    void setMaxFps(qreal maxFps);
+
+    quint32 framesPresented() const;
+    /**
+     * @brief framesCoalesced Frames from other threads replaced by a newer one before GUI thread presented them
+     */
+    quint32 framesCoalesced() const;
+
 signals:
     void dimensionsChanged();
+    void activeChanged();
+    void maxFpsChanged();
+    void displaySizeChanged();
+    void countersChanged();
 
 private slots:
-    void imshowFromVariant(const QVariant &matVariant);
+    void presentPending();
 
 private:
+    void present(const cv::Mat &mat);
     void stopSurface();
-    void createVideoFrame(const cv::Mat &mat);
-    bool matHasChanged(const cv::Mat &mat) const;
+    cv::Mat nextFrame(const QSize &size, QVideoFrame::PixelFormat pixelFormat, int type);
+    QVideoFrame::PixelFormat pixelFormatFor(int channels) const;
+    QSize presentedSize(const QSize &sourceSize) const;
+    void updateSupportedFormats();
     QAbstractVideoSurface* m_surface;
-    QVideoFrame* m_videoFrame;
+    QList<QVideoFrame::PixelFormat> m_supportedFormats;
+    /**
+     * Frames rotate between writer and surface, the one written is two presents away from the one on screen.
+     * Storage is shared with frame buffers and only grows, resizing just wraps it into a new QVideoFrame.
+     */
+    enum { FramePoolSize = 3 };
+    struct PooledFrame {
+        cv::Mat storage;
+        QVideoFrame frame;
+    };
+    PooledFrame m_frames[FramePoolSize];
+    int m_nextFrame;
     QVideoSurfaceFormat m_format;
+    QSize m_sourceSize;
+    QSize m_displaySize;
+    cv::Mat m_scaled;
     QString m_name;
+    // Written on GUI thread and read by wantsFrame() from other threads, both under the registry lock,
+    // m_surface too
+    bool m_active;
+    qreal m_maxFps;
+    qint64 m_lastFrameTime;
+
+    // Cross-thread slot, producers write m_pending, GUI thread swaps it with m_presenting
+    QMutex m_pendingLock;
+    cv::Mat m_pending;
+    cv::Mat m_presenting;
+    bool m_hasPending;
+    bool m_presentQueued;
+    QAtomicInteger<quint32> m_framesPresented;
+    QAtomicInteger<quint32> m_framesCoalesced;
+    bool m_presentFailed; ///< Failure is logged once until a present succeeds again
 };
 
+Q_DECLARE_LOGGING_CATEGORY(videoSurface)
+
 #endif // CVMATSURFACESOURCE_H
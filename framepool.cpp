@@ -0,0 +1,171 @@
+#include "framepool.h"
+
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+
+struct FrameSlot {
+    FrameSlot() : refs(0) {}
+    cv::Mat mat;
+    FrameInfo info;
+    QAtomicInt refs;
+};
+
+void frameToBgr(const cv::Mat &frame, PixelFormat format, cv::Mat &bgr)
+{
+    switch (format) {
+    case PixelFormat::BGR:
+        bgr = frame;
+        break;
+    case PixelFormat::YUYV:
+        cv::cvtColor(frame, bgr, cv::COLOR_YUV2BGR_YUYV);
+        break;
+    case PixelFormat::NV12:
+        cv::cvtColor(frame, bgr, cv::COLOR_YUV2BGR_NV12);
+        break;
+    case PixelFormat::Grey:
+        cv::cvtColor(frame, bgr, cv::COLOR_GRAY2BGR);
+        break;
+    }
+}
+
+FrameRef::FrameRef() : m_slot(nullptr)
+{
+}
+
+FrameRef::FrameRef(FrameSlot *slot) : m_slot(slot)
+{
+    if (m_slot)
+        m_slot->refs.ref();
+}
+
+FrameRef::FrameRef(const FrameRef &other) : FrameRef(other.m_slot)
+{
+}
+
+FrameRef &FrameRef::operator=(const FrameRef &other)
+{
+    FrameRef copy(other);
+    swap(copy);
+    return *this;
+}
+
+FrameRef::~FrameRef()
+{
+    reset();
+}
+
+bool FrameRef::isNull() const
+{
+    return m_slot == nullptr;
+}
+
+const cv::Mat &FrameRef::mat() const
+{
+    static const cv::Mat empty;
+    return m_slot ? m_slot->mat : empty;
+}
+
+const FrameInfo &FrameRef::info() const
+{
+    static const FrameInfo empty;
+    return m_slot ? m_slot->info : empty;
+}
+
+quint64 FrameRef::sequence() const
+{
+    return info().sequence;
+}
+
+qint64 FrameRef::timestamp() const
+{
+    return info().timestamp;
+}
+
+void FrameRef::reset()
+{
+    if (m_slot)
+        m_slot->refs.deref();
+    m_slot = nullptr;
+}
+
+void FrameRef::swap(FrameRef &other)
+{
+    qSwap(m_slot, other.m_slot);
+}
+
+FramePool::FramePool(int size) :
+    m_acquired(nullptr), m_current(nullptr), m_starved(0)
+{
+    for (int i = 0; i < size; ++i)
+        m_slots.append(new FrameSlot);
+}
+
+FramePool::~FramePool()
+{
+    clear();
+    foreach (FrameSlot *slot, m_slots) {
+        if (slot->refs.load() != 0)
+            qWarning() << "FramePool destroyed while frame" << slot->info.sequence << "is still referenced";
+    }
+    qDeleteAll(m_slots);
+}
+
+cv::Mat *FramePool::acquire()
+{
+    // Only current slot gains references through latest(), and it always holds one for the pool,
+    // so a slot seen with zero references stays free until it is published
+    m_acquired = nullptr;
+    foreach (FrameSlot *slot, m_slots) {
+        if (slot->refs.loadAcquire() == 0) {
+            m_acquired = slot;
+            return &slot->mat;
+        }
+    }
+    if (m_starved.fetchAndAddRelaxed(1) == 0)
+        qWarning() << "FramePool: all" << m_slots.size() << "slots are held by consumers, dropping frame";
+    return nullptr;
+}
+
+void FramePool::publish(const FrameInfo &info)
+{
+    if (!m_acquired)
+        return;
+    m_acquired->info = info;
+    m_acquired->refs.ref();
+
+    QMutexLocker lock(&m_currentLock);
+    FrameSlot *previous = m_current;
+    m_current = m_acquired;
+    m_acquired = nullptr;
+    lock.unlock();
+    if (previous)
+        previous->refs.deref();
+}
+
+FrameRef FramePool::latest() const
+{
+    QMutexLocker lock(&m_currentLock);
+    return FrameRef(m_current);
+}
+
+void FramePool::clear()
+{
+    QMutexLocker lock(&m_currentLock);
+    FrameSlot *previous = m_current;
+    m_current = nullptr;
+    lock.unlock();
+    if (previous)
+        previous->refs.deref();
+}
+
+quint64 FramePool::lastSequence() const
+{
+    QMutexLocker lock(&m_currentLock);
+    return m_current ? m_current->info.sequence : 0;
+}
+
+quint32 FramePool::starved() const
+{
+    return m_starved.load();
+}
@@ -0,0 +1,121 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QVector>
+#include <QMetaType>
+
+#include <opencv2/core.hpp>
+
+struct FrameSlot;
+
+/**
+ * @brief The PixelFormat enum Layout of frame pixels
+ */
+enum class PixelFormat : qint32 {
+    BGR,  ///< CV_8UC3
+    YUYV, ///< CV_8UC2, Y0 U Y1 V
+    NV12, ///< CV_8UC1, height * 3 / 2 rows: Y plane followed by interleaved UV plane of half resolution
+    Grey  ///< CV_8UC1
+};
+
+/**
+ * @brief frameToBgr Converts frame of any @ref PixelFormat to BGR, BGR frames are shared, not copied
+ */
+void frameToBgr(const cv::Mat &frame, PixelFormat format, cv::Mat &bgr);
+
+/**
+ * @brief The FrameInfo struct Identity of a captured frame
+ */
+struct FrameInfo {
+    FrameInfo() : sequence(0), timestamp(0), cameraTimestamp(-1), format(PixelFormat::BGR) {}
+    quint64 sequence;       ///< Grabbed frame number since capture start, starts at 1, gaps are dropped frames
+                            ///< (frames throttled by requested rate are not numbered)
+    qint64 timestamp;       ///< @ref LatencyStatistics::now() taken right after grab()
+    double cameraTimestamp; ///< CAP_PROP_POS_MSEC, driver buffer time or file position, <= 0 if not provided
+    PixelFormat format;
+};
+Q_DECLARE_METATYPE(FrameInfo)
+
+/**
+ * @brief The FrameRef class Read-only handle to a published frame
+ * Slot is not reused by the producer while at least one handle to it exists, so consumers keep
+ * it only as long as they read the frame. Copying is cheap, handles can be passed between threads.
+ */
+class FrameRef
+{
+public:
+    FrameRef();
+    FrameRef(const FrameRef &other);
+    FrameRef &operator=(const FrameRef &other);
+    ~FrameRef();
+
+    bool isNull() const;
+    /**
+     * @brief mat Frame pixels, must not be modified, clone() it if a writable copy is needed
+     */
+    const cv::Mat &mat() const;
+    const FrameInfo &info() const;
+    quint64 sequence() const;
+    qint64 timestamp() const;
+
+    /**
+     * @brief reset Releases the slot
+     */
+    void reset();
+    void swap(FrameRef &other);
+
+private:
+    friend class FramePool;
+    explicit FrameRef(FrameSlot *slot);
+    FrameSlot *m_slot;
+};
+
+/**
+ * @brief The FramePool class Fixed set of reference counted frame buffers written by one producer
+ * Producer fills a free slot from @ref acquire() and makes it current with @ref publish(), consumers
+ * get the current one from @ref latest() without copying pixels. Buffers are reused, so after the
+ * first frames no allocations happen unless resolution changes.
+ */
+class FramePool
+{
+public:
+    explicit FramePool(int size = 5);
+    ~FramePool();
+
+    /**
+     * @brief acquire Finds a slot nobody references, producer thread only
+     * @return Buffer to write next frame into or nullptr if consumers hold all slots
+     */
+    cv::Mat *acquire();
+    /**
+     * @brief publish Makes last acquired slot current, producer thread only
+     */
+    void publish(const FrameInfo &info);
+    /**
+     * @brief latest Current frame, thread safe
+     * @return Null handle if nothing was published yet or pool was cleared
+     */
+    FrameRef latest() const;
+    /**
+     * @brief clear Drops current frame, slots are still kept until consumers release them
+     */
+    void clear();
+
+    quint64 lastSequence() const;
+    /**
+     * @brief starved Frames that couldn't be published because all slots were held by consumers
+     */
+    quint32 starved() const;
+
+private:
+    Q_DISABLE_COPY(FramePool)
+    QVector<FrameSlot *> m_slots;
+    FrameSlot *m_acquired;
+    FrameSlot *m_current;
+    mutable QMutex m_currentLock;
+    QAtomicInteger<quint32> m_starved;
+};
+
+#endif // FRAMEPOOL_H
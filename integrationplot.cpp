@@ -0,0 +1,237 @@
+#include "integrationplot.h"
+
+#include <QSGFlatColorMaterial>
+#include <QSGGeometryNode>
+#include <QtMath>
+
+#include "linedetectordatasource.h"
+
+namespace {
+
+QSGGeometryNode *createLineNode(QSGGeometry::DrawingMode mode)
+{
+    QSGGeometry *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_Point2D(), 0);
+    geometry->setDrawingMode(mode);
+    QSGGeometryNode *node = new QSGGeometryNode;
+    node->setGeometry(geometry);
+    node->setFlag(QSGNode::OwnsGeometry);
+    node->setMaterial(new QSGFlatColorMaterial);
+    node->setFlag(QSGNode::OwnsMaterial);
+    return node;
+}
+
+void setNodeColor(QSGGeometryNode *node, const QColor &color)
+{
+    QSGFlatColorMaterial *material = static_cast<QSGFlatColorMaterial *>(node->material());
+    if (material->color() != color) {
+        material->setColor(color);
+        node->markDirty(QSGNode::DirtyMaterial);
+    }
+}
+
+// Vertex buffer is kept while the number of points stays, which is the usual case
+QSGGeometry::Point2D *vertices(QSGGeometryNode *node, int count, float lineWidth)
+{
+    QSGGeometry *geometry = node->geometry();
+    if (geometry->vertexCount() != count)
+        geometry->allocate(count);
+    geometry->setLineWidth(lineWidth);
+    node->markDirty(QSGNode::DirtyGeometry);
+    return geometry->vertexDataAsPoint2D();
+}
+
+} // namespace
+
+IntegrationPlot::IntegrationPlot(QQuickItem *parent) : QQuickItem(parent),
+    m_dirty(false), m_refreshRate(30), m_color(QColor("#209fdf")), m_beamColor(Qt::red), m_lineWidth(1),
+    m_profileChanged(false)
+{
+    setFlag(ItemHasContents);
+    m_refreshTimer.setSingleShot(true);
+    m_refreshTimer.setInterval(qRound(1000 / m_refreshRate));
+    connect(&m_refreshTimer, &QTimer::timeout,
+            this,            &IntegrationPlot::onRefreshTimeout);
+}
+
+LineDetectorDataSource *IntegrationPlot::source() const
+{
+    return m_source;
+}
+
+void IntegrationPlot::setSource(LineDetectorDataSource *source)
+{
+    if (m_source == source)
+        return;
+    if (m_source)
+        disconnect(m_source, nullptr, this, nullptr);
+    m_source = source;
+    if (m_source) {
+        connect(m_source, &LineDetectorDataSource::profileChanged,
+                this,     &IntegrationPlot::onDataChanged);
+        connect(m_source, &LineDetectorDataSource::beamChanged,
+                this,     &IntegrationPlot::onDataChanged);
+    }
+    fetch();
+    emit sourceChanged();
+}
+
+qreal IntegrationPlot::refreshRate() const
+{
+    return m_refreshRate;
+}
+
+void IntegrationPlot::setRefreshRate(qreal refreshRate)
+{
+    if (m_refreshRate == refreshRate)
+        return;
+    m_refreshRate = refreshRate;
+    m_refreshTimer.setInterval(m_refreshRate > 0 ? qRound(1000 / m_refreshRate) : 0);
+    emit refreshRateChanged();
+}
+
+QColor IntegrationPlot::color() const
+{
+    return m_color;
+}
+
+void IntegrationPlot::setColor(const QColor &color)
+{
+    if (m_color == color)
+        return;
+    m_color = color;
+    update();
+    emit colorChanged();
+}
+
+QColor IntegrationPlot::beamColor() const
+{
+    return m_beamColor;
+}
+
+void IntegrationPlot::setBeamColor(const QColor &beamColor)
+{
+    if (m_beamColor == beamColor)
+        return;
+    m_beamColor = beamColor;
+    update();
+    emit beamColorChanged();
+}
+
+qreal IntegrationPlot::lineWidth() const
+{
+    return m_lineWidth;
+}
+
+void IntegrationPlot::setLineWidth(qreal lineWidth)
+{
+    if (m_lineWidth == lineWidth)
+        return;
+    m_lineWidth = lineWidth;
+    update();
+    emit lineWidthChanged();
+}
+
+QSGNode *IntegrationPlot::updatePaintNode(QSGNode *oldNode, QQuickItem::UpdatePaintNodeData *)
+{
+    QSGNode *root = oldNode;
+    if (!root) {
+        root = new QSGNode;
+        root->appendChildNode(createLineNode(QSGGeometry::DrawLineStrip));
+        root->appendChildNode(createLineNode(QSGGeometry::DrawLines));
+    }
+    QSGGeometryNode *profileNode = static_cast<QSGGeometryNode *>(root->firstChild());
+    QSGGeometryNode *beamNode = static_cast<QSGGeometryNode *>(root->lastChild());
+    setNodeColor(profileNode, m_color);
+    setNodeColor(beamNode, m_beamColor);
+
+    const float w = width();
+    const float h = height();
+    if (m_profileChanged) {
+        const int rows = m_profile.size();
+        const int columns = qMax(1, qFloor(w));
+        const float *values = m_profile.constData();
+
+        if (rows <= 2 * columns) {
+            QSGGeometry::Point2D *v = vertices(profileNode, rows, m_lineWidth);
+            for (int i = 0; i < rows; ++i)
+                v[i].set(w * i / rows, h * (1.0f - qBound(0.0f, values[i], 1.0f)));
+        } else {
+            // Min and max of rows falling into every pixel column, in the order they occur so the strip doesn't zigzag
+            QSGGeometry::Point2D *v = vertices(profileNode, columns * 2, m_lineWidth);
+            for (int c = 0; c < columns; ++c) {
+                const int from = qint64(c) * rows / columns;
+                const int to = qint64(c + 1) * rows / columns;
+                int minRow = from, maxRow = from;
+                for (int i = from + 1; i < to; ++i) {
+                    if (values[i] < values[minRow])
+                        minRow = i;
+                    else if (values[i] > values[maxRow])
+                        maxRow = i;
+                }
+                const float x = w * (c + 0.5f) / columns;
+                const float first = values[qMin(minRow, maxRow)];
+                const float second = values[qMax(minRow, maxRow)];
+                v[c * 2].set(x, h * (1.0f - qBound(0.0f, first, 1.0f)));
+                v[c * 2 + 1].set(x, h * (1.0f - qBound(0.0f, second, 1.0f)));
+            }
+        }
+        // GUI thread is blocked here, the detector gets its buffer back as soon as the data source moves on
+        m_profile = QVector<float>();
+        m_profileChanged = false;
+    } else if (profileNode->geometry()->lineWidth() != float(m_lineWidth)) {
+        profileNode->geometry()->setLineWidth(m_lineWidth);
+        profileNode->markDirty(QSGNode::DirtyGeometry);
+    }
+
+    if (m_beamFrom != m_beamTo) {
+        QSGGeometry::Point2D *v = vertices(beamNode, 2, m_lineWidth * 2);
+        v[0].set(w * m_beamFrom.x(), h * (1.0f - qBound(0.0, m_beamFrom.y(), 1.0)));
+        v[1].set(w * m_beamTo.x(), h * (1.0f - qBound(0.0, m_beamTo.y(), 1.0)));
+    } else {
+        vertices(beamNode, 0, m_lineWidth * 2);
+    }
+    return root;
+}
+
+void IntegrationPlot::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    // Profile was released after it was drawn, it is taken from the source again for the new size
+    if (newGeometry.size() != oldGeometry.size())
+        fetch();
+}
+
+void IntegrationPlot::onDataChanged()
+{
+    // First change after a quiet interval is drawn at once, later ones are collected until timeout
+    if (m_refreshTimer.isActive()) {
+        m_dirty = true;
+        return;
+    }
+    fetch();
+    if (m_refreshRate > 0)
+        m_refreshTimer.start();
+}
+
+void IntegrationPlot::onRefreshTimeout()
+{
+    if (!m_dirty)
+        return;
+    fetch();
+    m_refreshTimer.start();
+}
+
+void IntegrationPlot::fetch()
+{
+    m_dirty = false;
+    m_profileChanged = true;
+    if (m_source) {
+        m_profile = m_source->profile();
+        m_beamFrom = m_source->beamFrom();
+        m_beamTo = m_source->beamTo();
+    } else {
+        m_profile.clear();
+        m_beamFrom = m_beamTo = QPointF();
+    }
+    update();
+}
@@ -0,0 +1,80 @@
+#ifndef INTEGRATIONPLOT_H
+#define INTEGRATIONPLOT_H
+
+#include <QColor>
+#include <QPointer>
+#include <QQuickItem>
+#include <QTimer>
+#include <QVector>
+
+class LineDetectorDataSource;
+
+/**
+ * @brief The IntegrationPlot class Row profile and beam limits drawn straight into scenegraph
+ * Profile is decimated to one min/max pair per pixel column, so geometry size depends on item width only.
+ * Profile vector is shared with the data source and released once it is turned into geometry,
+ * so the detector can reuse it.
+ * Item spans 0..1 on both axes, value 1 is on top.
+ */
+class IntegrationPlot : public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(LineDetectorDataSource* source READ source WRITE setSource NOTIFY sourceChanged)
+    Q_PROPERTY(qreal refreshRate READ refreshRate WRITE setRefreshRate NOTIFY refreshRateChanged)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged)
+    Q_PROPERTY(QColor beamColor READ beamColor WRITE setBeamColor NOTIFY beamColorChanged)
+    Q_PROPERTY(qreal lineWidth READ lineWidth WRITE setLineWidth NOTIFY lineWidthChanged)
+public:
+    explicit IntegrationPlot(QQuickItem *parent = nullptr);
+
+    LineDetectorDataSource *source() const;
+    void setSource(LineDetectorDataSource *source);
+
+    /**
+     * @brief refreshRate Redraw rate limit, newest profile is always drawn at the end of interval, 0 for no limit
+     */
+    qreal refreshRate() const;
+    void setRefreshRate(qreal refreshRate);
+
+    QColor color() const;
+    void setColor(const QColor &color);
+
+    QColor beamColor() const;
+    void setBeamColor(const QColor &beamColor);
+
+    qreal lineWidth() const;
+    void setLineWidth(qreal lineWidth);
+
+signals:
+    void sourceChanged();
+    void refreshRateChanged();
+    void colorChanged();
+    void beamColorChanged();
+    void lineWidthChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *) override;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+
+private slots:
+    void onDataChanged();
+    void onRefreshTimeout();
+
+private:
+    void fetch();
+
+    QPointer<LineDetectorDataSource> m_source;
+    QTimer m_refreshTimer;
+    bool m_dirty;
+    qreal m_refreshRate;
+    QColor m_color;
+    QColor m_beamColor;
+    qreal m_lineWidth;
+
+    QVector<float> m_profile; ///< Empty after updatePaintNode() until next fetch()
+    bool m_profileChanged;
+    QPointF m_beamFrom;
+    QPointF m_beamTo;
+};
+
+#endif // INTEGRATIONPLOT_H
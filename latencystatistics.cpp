@@ -0,0 +1,141 @@
+#include "latencystatistics.h"
+
+#include <QTimer>
+#include <QMutex>
+#include <QMetaEnum>
+#include <QVariantMap>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+Q_LOGGING_CATEGORY(latency, "vhrd.vision.latency")
+
+namespace {
+enum { WindowSize = 1024 };
+
+struct StageSamples {
+    StageSamples() : count(0), position(0) {}
+    qint64 samples[WindowSize];
+    int count;
+    int position;
+};
+} // namespace
+
+struct LatencyStatisticsPrivate {
+    QMutex lock;
+    StageSamples stages[LatencyStatistics::StageCount];
+};
+Q_GLOBAL_STATIC(LatencyStatisticsPrivate, g_latency)
+
+LatencyStatistics::LatencyStatistics(QObject *parent) : QObject(parent),
+    m_logInterval(10), m_secondsSinceLog(0)
+{
+    m_timer = new QTimer(this);
+    m_timer->setInterval(1000);
+    connect(m_timer, &QTimer::timeout,
+            this,    &LatencyStatistics::onTimeout);
+    m_timer->start();
+}
+
+qint64 LatencyStatistics::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyStatistics::record(LatencyStatistics::Stage stage, qint64 nsecs)
+{
+    LatencyStatisticsPrivate *d = g_latency;
+    if (!d || stage < 0 || stage >= StageCount)
+        return;
+    QMutexLocker lock(&d->lock);
+    StageSamples &s = d->stages[stage];
+    s.samples[s.position] = nsecs;
+    s.position = (s.position + 1) % WindowSize;
+    s.count = qMin<int>(s.count + 1, WindowSize);
+}
+
+qint64 LatencyStatistics::recordSince(LatencyStatistics::Stage stage, qint64 since)
+{
+    qint64 t = now();
+    record(stage, t - since);
+    return t;
+}
+
+QVariantList LatencyStatistics::stages() const
+{
+    return m_stages;
+}
+
+int LatencyStatistics::logInterval() const
+{
+    return m_logInterval;
+}
+
+void LatencyStatistics::setLogInterval(int logInterval)
+{
+    m_logInterval = qMax(0, logInterval);
+    m_secondsSinceLog = 0;
+}
+
+void LatencyStatistics::reset()
+{
+    LatencyStatisticsPrivate *d = g_latency;
+    if (d) {
+        QMutexLocker lock(&d->lock);
+        for (int i = 0; i < StageCount; ++i)
+            d->stages[i] = StageSamples();
+    }
+    m_stages.clear();
+    emit updated();
+}
+
+void LatencyStatistics::onTimeout()
+{
+    LatencyStatisticsPrivate *d = g_latency;
+    if (!d)
+        return;
+
+    // Copy windows out, so sorting doesn't hold the lock recording threads need
+    std::vector<qint64> windows[StageCount];
+    {
+        QMutexLocker lock(&d->lock);
+        for (int i = 0; i < StageCount; ++i)
+            windows[i].assign(d->stages[i].samples, d->stages[i].samples + d->stages[i].count);
+    }
+
+    const QMetaEnum stageEnum = QMetaEnum::fromType<Stage>();
+    QString line;
+    m_stages.clear();
+    for (int i = 0; i < StageCount; ++i) {
+        std::vector<qint64> &w = windows[i];
+        if (w.empty())
+            continue;
+        std::sort(w.begin(), w.end());
+        auto percentile = [&w](int p) {
+            return w[(w.size() - 1) * p / 100] / 1e6;
+        };
+        QVariantMap stage;
+        stage["name"] = QString(stageEnum.valueToKey(i));
+        stage["count"] = static_cast<int>(w.size());
+        stage["p50"] = percentile(50);
+        stage["p95"] = percentile(95);
+        stage["p99"] = percentile(99);
+        stage["max"] = w.back() / 1e6;
+        m_stages.append(stage);
+        line += QString(" %1: %2/%3/%4/%5")
+                .arg(stageEnum.valueToKey(i))
+                .arg(percentile(50), 0, 'f', 2)
+                .arg(percentile(95), 0, 'f', 2)
+                .arg(percentile(99), 0, 'f', 2)
+                .arg(w.back() / 1e6, 0, 'f', 2);
+    }
+    emit updated();
+
+    if (m_logInterval == 0 || ++m_secondsSinceLog < m_logInterval)
+        return;
+    m_secondsSinceLog = 0;
+    if (!line.isEmpty())
+        qCInfo(latency).noquote() << "p50/p95/p99/max ms:" << line;
+}
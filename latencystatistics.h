@@ -0,0 +1,82 @@
+#ifndef LATENCYSTATISTICS_H
+#define LATENCYSTATISTICS_H
+
+#include <QObject>
+#include <QLoggingCategory>
+#include <QVariantList>
+
+class QTimer;
+
+/**
+ * @brief The LatencyStatistics class Rolling per-stage latency percentiles of the frame pipeline
+ * Stages are recorded from any thread through static @ref record(), this object aggregates them
+ * on its own thread, exposes the result to QML and prints it to the log periodically.
+ */
+class LatencyStatistics : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QVariantList stages READ stages NOTIFY updated)
+    Q_PROPERTY(int logInterval READ logInterval WRITE setLogInterval)
+public:
+    explicit LatencyStatistics(QObject *parent = nullptr);
+
+    enum Stage {
+        Grab,       ///< VideoCapture::grab() call
+        Retrieve,   ///< VideoCapture::retrieve() call
+        Display,    ///< Undistort and show "main" view
+        Queue,      ///< grab() return to detector start, includes retrieve and mailbox wait
+        Remap,      ///< Detector undistort + rotation
+        Integrate,  ///< Detector HSV threshold and row integration
+        Visualize,  ///< Detector debug view
+        Deliver,    ///< Detector result to GUI thread, event loop delay
+        Total,      ///< grab() return to dzChanged() emission
+        StageCount
+    };
+    Q_ENUM(Stage)
+
+    /**
+     * @brief now Monotonic timestamp in ns, comparable between threads
+     */
+    static qint64 now();
+    /**
+     * @brief record Adds one sample, thread safe
+     * @param stage
+     * @param nsecs Duration in ns
+     */
+    static void record(Stage stage, qint64 nsecs);
+    /**
+     * @brief recordSince Adds now() - since sample
+     * @return now()
+     */
+    static qint64 recordSince(Stage stage, qint64 since);
+
+    /**
+     * @brief stages List of maps with name, count, p50, p95, p99 and max (ms) per stage
+     * Only stages with samples in the rolling window are listed.
+     */
+    QVariantList stages() const;
+
+    /**
+     * @brief logInterval Seconds between log lines, 0 to disable logging
+     */
+    int logInterval() const;
+    void setLogInterval(int logInterval);
+
+    Q_INVOKABLE void reset();
+
+signals:
+    void updated();
+
+private slots:
+    void onTimeout();
+
+private:
+    QTimer *m_timer;
+    QVariantList m_stages;
+    int m_logInterval;
+    int m_secondsSinceLog;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(latency)
+
+#endif // LATENCYSTATISTICS_H
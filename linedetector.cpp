@@ -2,9 +2,14 @@
 
 #include <QTimer>
 
+#include <algorithm>
+
 #include "linedetector.h"
+#include "beamkernel.h"
 #include "capturecontroller.hpp"
 #include "cvmatsurfacesource.hpp"
+#include "latencystatistics.h"
+#include "threadtuning.h"
 
 Q_LOGGING_CATEGORY(lineDetector, "vhrd.vision.linedetector")
 
@@ -38,6 +43,14 @@ LineDetector::LineDetector(CaptureController *captureController, QObject *parent
     m_lx = 180;
 
     m_angle = 0;
+    m_debugView = true;
+    m_tracking = false;
+    m_trackingWindow = 0.1;
+    m_stripes = 0;
+    m_differencing = NoDifferencing;
+    m_differencingSettleFrames = 1;
+    m_differencingPower = 0.2;
+    m_laserPower = -1;
 
     m_hueLowRangeFrom = 0;
     m_hueLowRangeTo = 10;
@@ -47,9 +60,43 @@ LineDetector::LineDetector(CaptureController *captureController, QObject *parent
     m_saturationTo = 255;
     m_valueFrom = 10;
     m_valueTo = 255;
+    m_chromaRedFrom = 150;
     m_integrateFrom = 0.2;
     m_integrateTo = 0.8;
     m_threshold = 0.6;
+
+    m_consumerId = captureController->registerConsumer("lineDetector");
+    m_processScheduled = false;
+    m_mailboxFull = false;
+    m_framesProcessed = 0;
+    m_framesDropped = 0;
+    m_bufferResizes = 0;
+
+    // Checked in every build, it takes well under a millisecond and release builds are the ones on the board
+    if (!BeamKernel::selfTest()) {
+        qCWarning(lineDetector) << "Vector row kernels differ from scalar one, using scalar";
+        BeamKernel::useScalar();
+    }
+    qCDebug(lineDetector) << "Using" << BeamKernel::implementationName() << "row kernel";
+
+    qRegisterMetaType<QVector<float>>();
+    qRegisterMetaType<FrameInfo>();
+    m_worker = new LineDetectorWorker(this, captureController);
+    m_worker->moveToThread(&m_workerThread);
+    connect(m_worker, &LineDetectorWorker::frameProcessed,
+            this,     &LineDetector::onFrameProcessed);
+    connect(m_worker, &LineDetectorWorker::laserPowerRequested,
+            this,     &LineDetector::onDifferencingLaserPower);
+    connect(&m_workerThread, &QThread::started,
+            m_worker,        []() { ThreadTuning::apply("detector"); });
+    m_workerThread.start();
+}
+
+LineDetector::~LineDetector()
+{
+    m_workerThread.quit();
+    m_workerThread.wait();
+    delete m_worker;
 }
 
 LineDetector::State LineDetector::state() const
@@ -59,86 +106,34 @@ LineDetector::State LineDetector::state() const
 
 void LineDetector::onFrameReady()
 {
-    cv::Mat frame = m_captureController->frameCopy();
-
-    cv::Mat rm = cv::getRotationMatrix2D(cv::Point(frame.cols / 2, frame.rows / 2), m_angle + 90, 1.0);
-    cv::Mat rotated;
-    cv::warpAffine(frame, rotated, rm, cv::Size(frame.cols, frame.rows));
-    frame = rotated;
-
-    // Convert to HSV, filter
-    cv::Mat hsv;
-    cv::cvtColor(frame, hsv, cv::COLOR_BGR2HSV);
-    cv::Mat upper_red_hue;
-    cv::Mat lower_red_hue;
-    cv::inRange(hsv,
-                cv::Scalar(m_hueLowRangeFrom, m_saturationFrom, m_valueFrom),
-                cv::Scalar(m_hueLowRangeTo, m_saturationTo, m_valueTo),
-                lower_red_hue);
-    cv::inRange(hsv,
-                cv::Scalar(m_hueHighRangeFrom, m_saturationFrom, m_valueFrom),
-                cv::Scalar(m_hueHighRangeTo, m_saturationTo, m_valueTo),
-                upper_red_hue);
-    cv::Mat red_hue;
-    cv::addWeighted(lower_red_hue, 1.0, upper_red_hue, 1.0, 0.0, red_hue);
-
-    // Mask V channel
-    std::vector<cv::Mat> hsvSplitted;
-    cv::split(hsv, hsvSplitted);
-    cv::Mat masked;
-    hsvSplitted[2].copyTo(masked, red_hue);
-
-    // Integration limits
-    quint16 colfrom = m_integrateFrom * frame.cols;
-    quint16 colto = m_integrateTo * frame.cols;
-
-    // Show as red channel
-    cv::Mat desaturateMask(frame.rows, frame.cols, CV_8UC1, cv::Scalar(0));
-    cv::rectangle(desaturateMask, cv::Point(0, 0), cv::Point(colfrom, frame.rows), cv::Scalar(255), -1);
-    cv::rectangle(desaturateMask, cv::Point(colto, 0), cv::Point(frame.cols, frame.rows), cv::Scalar(255), -1);
-    cv::subtract(masked, cv::Scalar(127), masked, desaturateMask);
-
-    cv::Mat zero(frame.rows, frame.cols, CV_8UC1, cv::Scalar(0));
-    std::vector<cv::Mat> channels;
-    channels.push_back(zero);
-    channels.push_back(zero);
-    channels.push_back(masked);
-    cv::Mat merged;
-    cv::merge(channels, merged);
-    CVMatSurfaceSource::imshow("second", merged);
-
-    // Integrate
-    QVector<float> linesSum;
-    quint8 *mdata = static_cast<quint8 *>(masked.data);
-    for (quint16 row = frame.rows - 1; row > 0; row--) {
-        float s = 0;
-        for (quint16 col = colfrom; col < colto; col++) {
-            s += mdata[masked.step * row + col];
-        }
-        linesSum.push_back(s);
-    }
-    float max = 0;
-    float thresholdAbs = m_threshold * frame.cols * 255;
-    QVector<int> overThreshold;
-    for (int i = 0; i < linesSum.size(); i++) {
-        if (linesSum[i] > max) {
-            max = linesSum[i];
-        }
-        if (linesSum[i] > thresholdAbs) {
-            overThreshold.push_back(i);
-        }
-    }
-    for (int i = 0; i < linesSum.size(); i++) {
-        linesSum[i] = linesSum[i] / max;
+    FrameRef frame = m_captureController->latestFrame();
+    if (frame.isNull())
+        return;
+
+    // Only the newest frame is kept, processing is requested once until worker picks it up.
+    // Replaced handle is released after the lock, so capture can reuse its slot.
+    QMutexLocker lock(&m_mailboxLock);
+    if (m_mailboxFull)
+        m_framesDropped.fetchAndAddRelaxed(1);
+    m_mailbox.swap(frame);
+    m_mailboxFull = true;
+    if (!m_processScheduled) {
+        m_processScheduled = true;
+        QMetaObject::invokeMethod(m_worker, "process", Qt::QueuedConnection);
     }
+}
+
+void LineDetector::onFrameProcessed(const QVector<float> &linesSum, int x1, int x2, const FrameInfo &info, qint64 processedAt)
+{
+    LatencyStatistics::recordSince(LatencyStatistics::Deliver, processedAt);
     emit integrationComplete(linesSum);
+    emit countersChanged();
 
     // Find thicknes and center of a light beam
-    if (overThreshold.count() >= 2) {
-        int x1 = overThreshold.last();
-        QPointF pt1((float)x1 / float(frame.rows), linesSum[x1]);
-        int x2 = overThreshold.first();
-        QPointF pt2((float)x2 / float(frame.rows), pt1.y());
+    if (x1 >= 0) {
+        int rows = linesSum.size() + 1;
+        QPointF pt1((float)x1 / float(rows), linesSum[x1]);
+        QPointF pt2((float)x2 / float(rows), pt1.y());
         emit lineDetected(pt1, pt2);
 
         // Find dz
@@ -157,6 +152,7 @@ void LineDetector::onFrameReady()
         else
             qDebug() << m_dz;*/
         emit dzChanged(m_dz);
+        LatencyStatistics::recordSince(LatencyStatistics::Total, info.timestamp);
 
         if (m_state != Locked) {
             m_state = Locked;
@@ -171,6 +167,421 @@ void LineDetector::onFrameReady()
             emit stateChanged();
         }
     }
+
+    // dz for this frame is delivered, lock-step replay can move on
+    m_captureController->acknowledgeFrame(m_consumerId, info.sequence);
+}
+
+LineDetectorSettings LineDetector::settings() const
+{
+    QMutexLocker lock(&m_settingsLock);
+    LineDetectorSettings s;
+    s.thresholds.hueLowFrom = m_hueLowRangeFrom;
+    s.thresholds.hueLowTo = m_hueLowRangeTo;
+    s.thresholds.hueHighFrom = m_hueHighRangeFrom;
+    s.thresholds.hueHighTo = m_hueHighRangeTo;
+    s.thresholds.saturationFrom = m_saturationFrom;
+    s.thresholds.saturationTo = m_saturationTo;
+    s.thresholds.valueFrom = m_valueFrom;
+    s.thresholds.valueTo = m_valueTo;
+    s.chromaThresholds.valueFrom = m_valueFrom;
+    s.chromaThresholds.valueTo = m_valueTo;
+    s.chromaThresholds.chromaRedFrom = m_chromaRedFrom;
+    s.integrateFrom = m_integrateFrom;
+    s.integrateTo = m_integrateTo;
+    s.threshold = m_threshold;
+    s.angle = m_angle;
+    s.debugView = m_debugView;
+    s.tracking = m_tracking;
+    s.trackingWindow = m_trackingWindow;
+    s.stripes = m_stripes;
+    s.differencing = m_differencing;
+    s.differencingSettleFrames = m_differencingSettleFrames;
+    s.differencingPower = m_differencingPower;
+    return s;
+}
+
+quint32 LineDetector::framesProcessed() const
+{
+    return m_framesProcessed.load();
+}
+
+quint32 LineDetector::framesDropped() const
+{
+    return m_framesDropped.load();
+}
+
+quint32 LineDetector::bufferResizes() const
+{
+    return m_bufferResizes.load();
+}
+
+void LineDetector::countBufferResize(int cols, int rows)
+{
+#ifndef QT_NO_DEBUG
+    quint32 count = m_bufferResizes.fetchAndAddRelaxed(1) + 1;
+    qCDebug(lineDetector) << "Buffer resize" << count << cols << rows;
+#else
+    Q_UNUSED(cols);
+    Q_UNUSED(rows);
+#endif
+}
+
+LineDetectorWorker::LineDetectorWorker(LineDetector *lineDetector, CaptureController *captureController, QObject *parent) :
+    QObject(parent), m_lineDetector(lineDetector), m_captureController(captureController),
+    m_trackCenter(-1), m_trackThickness(0), m_trackMisses(0),
+    m_remapAngle(0), m_remapRevision(0),
+    m_differencing(LineDetector::NoDifferencing), m_laserOn(true), m_laserSettledFrom(0),
+    m_referenceSequence(0), m_referenceOn(false)
+{
+}
+
+namespace {
+// Stripe body is called through a vtable, wrapping lambdas in std::function would allocate on every frame
+template <typename Body>
+class StripeLoop : public cv::ParallelLoopBody
+{
+public:
+    explicit StripeLoop(const Body &body) : m_body(body) {}
+    void operator()(const cv::Range &range) const override { m_body(range); }
+
+private:
+    const Body &m_body;
+};
+} // namespace
+
+template <typename Body>
+void LineDetectorWorker::runStripes(int stripes, const Body &body)
+{
+    if (stripes == 1)
+        body(cv::Range(0, 1));
+    else
+        cv::parallel_for_(cv::Range(0, stripes), StripeLoop<Body>(body), stripes);
+}
+
+void LineDetectorWorker::process()
+{
+    {
+        QMutexLocker lock(&m_lineDetector->m_mailboxLock);
+        m_lineDetector->m_processScheduled = false;
+        if (!m_lineDetector->m_mailboxFull)
+            return;
+        m_frame.swap(m_lineDetector->m_mailbox);
+        m_lineDetector->m_mailboxFull = false;
+    }
+    m_captureController->frameConsumed(m_lineDetector->m_consumerId, m_frame.info());
+    qint64 t = LatencyStatistics::recordSince(LatencyStatistics::Queue, m_frame.timestamp());
+    const LineDetectorSettings settings = m_lineDetector->settings();
+    const int stripes = settings.stripes > 0 ? settings.stripes : qMax(1, cv::getNumThreads());
+    // BGR frames are thresholded in HSV, native ones on Y and Cr without any color conversion
+    const bool hsv = m_frame.info().format == PixelFormat::BGR;
+    const cv::Mat *integrated = difference(lumaChroma(m_frame.mat(), m_frame.info().format, stripes),
+                                           m_frame.sequence(), settings);
+    if (!integrated) {
+        // Reference frame or exposed while laser was switching, nothing to integrate
+        const quint64 sequence = m_frame.sequence();
+        m_frame.reset();
+        m_captureController->acknowledgeFrame(m_lineDetector->m_consumerId, sequence);
+        return;
+    }
+    const cv::Mat &frame = *integrated;
+
+    updateRemap(frame.size(), settings.angle);
+    ensureBuffer(m_rotated, frame.rows, frame.cols, frame.type());
+    if (m_hsvRows.size() != stripes) {
+        m_hsvRows.resize(stripes);
+        m_lineDetector->countBufferResize(stripes, 1);
+    }
+    if (hsv) {
+        for (int i = 0; i < stripes; ++i)
+            ensureBuffer(m_hsvRows[i], 1, frame.cols, CV_8UC3);
+    }
+    cv::Mat *hsvRows = m_hsvRows.data();
+    auto extractRow = [&](const cv::Mat &rotatedRow, cv::Mat &hsvRow, int colFrom, int colTo, quint8 *debug) {
+        if (!hsv)
+            return BeamKernel::extractRowYCr(rotatedRow.ptr<quint8>(), frame.channels(), rotatedRow.cols,
+                                             settings.chromaThresholds, colFrom, colTo, debug);
+        cv::cvtColor(rotatedRow, hsvRow, cv::COLOR_BGR2HSV);
+        return BeamKernel::extractRow(hsvRow.ptr<quint8>(), rotatedRow.cols, settings.thresholds, colFrom, colTo, debug);
+    };
+
+    // Integration limits
+    quint16 colfrom = settings.integrateFrom * frame.cols;
+    quint16 colto = settings.integrateTo * frame.cols;
+    colto = qMin<quint16>(colto, frame.cols);
+
+    // Rows to integrate, row 0 is never integrated
+    int rowFrom = 1;
+    int rowTo = frame.rows - 1;
+    if (settings.tracking)
+        trackingRows(frame.rows, settings.trackingWindow, rowFrom, rowTo);
+
+    QVector<float> &linesSum = linesSumBuffer(frame.rows - 1);
+    float *sums = linesSum.data();
+
+    // Convert to HSV (or take Y, Cr), filter, mask V (Y) channel and integrate row by row, so every pixel
+    // is touched once and the working set stays in cache. Masked V is shown as red channel.
+    // Rows are split into stripes processed in parallel, each stripe writes only its own rows.
+    if (settings.debugView && CVMatSurfaceSource::wantsFrame("second")) {
+        ensureBuffer(m_debug, frame.rows, frame.cols, CV_8UC3);
+        cv::remap(frame, m_rotated, m_remap1, m_remap2, cv::INTER_LINEAR);
+        t = LatencyStatistics::recordSince(LatencyStatistics::Remap, t);
+        runStripes(stripes, [&](const cv::Range &range) {
+            for (int stripe = range.start; stripe < range.end; ++stripe) {
+                cv::Mat &hsvRow = hsvRows[stripe];
+                int to = frame.rows * (stripe + 1) / stripes;
+                for (int row = frame.rows * stripe / stripes; row < to; row++) {
+                    quint32 s = extractRow(m_rotated.row(row), hsvRow, colfrom, colto, m_debug.ptr<quint8>(row));
+                    if (row >= rowFrom && row <= rowTo)
+                        sums[frame.rows - 1 - row] = s;
+                }
+            }
+        });
+        t = LatencyStatistics::recordSince(LatencyStatistics::Integrate, t);
+        CVMatSurfaceSource::imshow("second", m_debug);
+        LatencyStatistics::recordSince(LatencyStatistics::Visualize, t);
+    } else if (colto > colfrom) {
+        // Only the integration band: remap with a slice of the table samples just the source pixels
+        // this band back-projects to through rotation and undistortion.
+        // Destination and row buffers are views into full sized buffers, so window changes don't reallocate.
+        cv::Rect band(colfrom, rowFrom, colto - colfrom, rowTo - rowFrom + 1);
+        cv::Mat rotated = m_rotated(cv::Rect(0, 0, band.width, band.height));
+        cv::remap(frame, rotated, m_remap1(band), m_remap2(band), cv::INTER_LINEAR);
+        t = LatencyStatistics::recordSince(LatencyStatistics::Remap, t);
+        runStripes(stripes, [&](const cv::Range &range) {
+            for (int stripe = range.start; stripe < range.end; ++stripe) {
+                cv::Mat hsvRow = hsv ? hsvRows[stripe].colRange(0, band.width) : cv::Mat();
+                int to = rowFrom + band.height * (stripe + 1) / stripes;
+                for (int row = rowFrom + band.height * stripe / stripes; row < to; row++) {
+                    sums[frame.rows - 1 - row] = extractRow(rotated.row(row - rowFrom), hsvRow, 0, band.width, nullptr);
+                }
+            }
+        });
+        LatencyStatistics::recordSince(LatencyStatistics::Integrate, t);
+    }
+
+    float max = 0;
+    float thresholdAbs = settings.threshold * frame.cols * 255;
+    int overThresholdFirst = -1;
+    int overThresholdLast = -1;
+    int overThresholdCount = 0;
+    for (int i = 0; i < linesSum.size(); i++) {
+        if (sums[i] > max) {
+            max = sums[i];
+        }
+        if (sums[i] > thresholdAbs) {
+            if (overThresholdFirst < 0)
+                overThresholdFirst = i;
+            overThresholdLast = i;
+            overThresholdCount++;
+        }
+    }
+    for (int i = 0; i < linesSum.size(); i++) {
+        sums[i] = sums[i] / max;
+    }
+
+    int x1 = -1;
+    int x2 = -1;
+    if (overThresholdCount >= 2) {
+        x1 = overThresholdLast;
+        x2 = overThresholdFirst;
+        m_trackCenter = frame.rows - 1 - (x1 + x2) / 2;
+        m_trackThickness = x1 - x2;
+        m_trackMisses = 0;
+    } else {
+        m_trackMisses++;
+    }
+
+    m_lineDetector->m_framesProcessed.fetchAndAddRelaxed(1);
+    FrameInfo info = m_frame.info();
+    m_frame.reset();
+    emit frameProcessed(linesSum, x1, x2, info, LatencyStatistics::now());
+}
+
+void LineDetectorWorker::ensureBuffer(cv::Mat &buffer, int rows, int cols, int type)
+{
+    if (buffer.rows == rows && buffer.cols == cols && buffer.type() == type)
+        return;
+    buffer.create(rows, cols, type);
+    m_lineDetector->countBufferResize(cols, rows);
+}
+
+QVector<float> &LineDetectorWorker::linesSumBuffer(int size)
+{
+    // Vectors are shared with queued frameProcessed() until GUI thread is done with them,
+    // pick one nobody else holds
+    QVector<float> *buffer = nullptr;
+    for (int i = 0; i < LinesSumBuffers && !buffer; ++i) {
+        if (m_linesSum[i].isDetached())
+            buffer = &m_linesSum[i];
+    }
+    for (int i = 0; i < LinesSumBuffers && !buffer; ++i) {
+        if (m_linesSum[i].isEmpty())
+            buffer = &m_linesSum[i];
+    }
+    if (!buffer) {
+        buffer = &m_linesSum[0];
+        *buffer = QVector<float>();
+    }
+    if (buffer->size() != size || !buffer->isDetached()) {
+        buffer->resize(size);
+        m_lineDetector->countBufferResize(size, 1);
+    }
+    std::fill(buffer->begin(), buffer->end(), 0.0f);
+    return *buffer;
+}
+
+void LineDetectorWorker::trackingRows(int rows, float trackingWindow, int &rowFrom, int &rowTo)
+{
+    if (m_trackCenter < 0)
+        return;
+    // Window is centered on the last beam position and doubles with every frame without beam, so it
+    // covers the whole frame after a few frames of Hold, well before detector becomes Unlocked
+    int half = qMax<int>(trackingWindow * rows / 2, m_trackThickness);
+    for (int i = 0; i < m_trackMisses && half < rows; ++i)
+        half *= 2;
+    if (half >= rows) {
+        m_trackCenter = -1;
+        return;
+    }
+    rowFrom = qMax(rowFrom, m_trackCenter - half);
+    rowTo = qMin(rowTo, m_trackCenter + half);
+    if (rowFrom > rowTo) { // stale center after resolution change
+        m_trackCenter = -1;
+        rowFrom = 1;
+        rowTo = rows - 1;
+    }
+}
+
+const cv::Mat &LineDetectorWorker::lumaChroma(const cv::Mat &raw, PixelFormat format, int stripes)
+{
+    if (format == PixelFormat::BGR || format == PixelFormat::Grey)
+        return raw;
+    // Y and Cr of every pixel side by side, so the image can be remapped as a regular two channel one.
+    // Far cheaper than YUV->BGR->HSV, only bytes are moved.
+    const int rows = format == PixelFormat::NV12 ? raw.rows * 2 / 3 : raw.rows;
+    ensureBuffer(m_ycr, rows, raw.cols, CV_8UC2);
+    runStripes(stripes, [&](const cv::Range &range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            int to = rows * (stripe + 1) / stripes;
+            for (int row = rows * stripe / stripes; row < to; row++) {
+                if (format == PixelFormat::YUYV)
+                    BeamKernel::yuyvToYCr(raw.ptr<quint8>(row), raw.cols, m_ycr.ptr<quint8>(row));
+                else
+                    BeamKernel::nv12ToYCr(raw.ptr<quint8>(row), raw.ptr<quint8>(rows + row / 2), raw.cols,
+                                          m_ycr.ptr<quint8>(row));
+            }
+        }
+    });
+    return m_ycr;
+}
+
+const cv::Mat *LineDetectorWorker::difference(const cv::Mat &frame, quint64 sequence, const LineDetectorSettings &settings)
+{
+    if (settings.differencing != m_differencing) {
+        m_differencing = settings.differencing;
+        m_referenceSequence = 0;
+        // Laser is left steadily on in every mode, LaserControlled starts from "on" once it settles
+        m_laserOn = true;
+        m_laserSettledFrom = m_captureController->lastSequence() + 2 + settings.differencingSettleFrames;
+        if (m_differencing == LineDetector::LaserControlled)
+            emit laserPowerRequested(settings.differencingPower);
+    }
+    if (m_differencing == LineDetector::NoDifferencing)
+        return &frame;
+
+    bool on;
+    if (m_differencing == LineDetector::OddFramesOn) {
+        on = sequence & 1;
+    } else {
+        if (sequence < m_laserSettledFrom)
+            return nullptr;
+        on = m_laserOn;
+    }
+    // Pairs are keyed by sequence: alternating frames must be neighbours, switched ones only need to be settled
+    const bool paired = m_referenceSequence != 0 && m_referenceOn != on &&
+            m_reference.size() == frame.size() && m_reference.type() == frame.type() &&
+            (m_differencing == LineDetector::LaserControlled || sequence == m_referenceSequence + 1);
+    if (paired) {
+        const cv::Mat &laserOn = on ? frame : m_reference;
+        const cv::Mat &laserOff = on ? m_reference : frame;
+        ensureBuffer(m_difference, frame.rows, frame.cols, frame.type());
+        cv::subtract(laserOn, laserOff, m_difference); // saturates at 0, light that only got darker is dropped
+        if (frame.channels() == 2) {
+            // Chroma doesn't add up, Cr of lit frame is kept for the red test
+            const int fromTo[] = {1, 1};
+            cv::mixChannels(&laserOn, 1, &m_difference, 1, fromTo, 1);
+        }
+    }
+    ensureBuffer(m_reference, frame.rows, frame.cols, frame.type());
+    frame.copyTo(m_reference);
+    m_referenceSequence = sequence;
+    m_referenceOn = on;
+
+    if (m_differencing == LineDetector::LaserControlled) {
+        // Frame being captured now was exposed partly before the switch
+        m_laserOn = !on;
+        m_laserSettledFrom = m_captureController->lastSequence() + 2 + settings.differencingSettleFrames;
+        emit laserPowerRequested(m_laserOn ? settings.differencingPower : 0);
+    }
+    return paired ? &m_difference : nullptr;
+}
+
+void LineDetectorWorker::updateRemap(const cv::Size &frameSize, float angle)
+{
+    if (!m_remap1.empty() && frameSize == m_remapSize && angle == m_remapAngle &&
+            m_captureController->undistortRevision() == m_remapRevision)
+        return;
+
+    cv::Mat intrinsic;
+    cv::Mat distCoeffs;
+    m_remapRevision = m_captureController->undistortData(intrinsic, distCoeffs);
+    m_remapSize = frameSize;
+    m_remapAngle = angle;
+
+    cv::Mat undistortMap;
+    if (!intrinsic.empty()) {
+        cv::Mat unused;
+        cv::initUndistortRectifyMap(intrinsic, distCoeffs, cv::Mat(), intrinsic, frameSize,
+                                    CV_32FC2, undistortMap, unused);
+    }
+
+    // Map every pixel of rotated image back through inverse rotation and then through undistort map
+    cv::Mat rm = cv::getRotationMatrix2D(cv::Point(frameSize.width / 2, frameSize.height / 2), angle + 90, 1.0);
+    cv::Mat inverse;
+    cv::invertAffineTransform(rm, inverse);
+    const double *im = inverse.ptr<double>();
+    const float maxx = frameSize.width - 1;
+    const float maxy = frameSize.height - 1;
+    cv::Mat map(frameSize, CV_32FC2);
+    for (int y = 0; y < frameSize.height; ++y) {
+        cv::Point2f *dst = map.ptr<cv::Point2f>(y);
+        for (int x = 0; x < frameSize.width; ++x) {
+            float sx = im[0] * x + im[1] * y + im[2];
+            float sy = im[3] * x + im[4] * y + im[5];
+            if (sx < 0 || sy < 0 || sx > maxx || sy > maxy) {
+                dst[x] = cv::Point2f(-1, -1); // outside, becomes black as with warpAffine
+                continue;
+            }
+            if (undistortMap.empty()) {
+                dst[x] = cv::Point2f(sx, sy);
+                continue;
+            }
+            int x0 = static_cast<int>(sx);
+            int y0 = static_cast<int>(sy);
+            int x1 = qMin(x0 + 1, frameSize.width - 1);
+            int y1 = qMin(y0 + 1, frameSize.height - 1);
+            float fx = sx - x0;
+            float fy = sy - y0;
+            const cv::Point2f *r0 = undistortMap.ptr<cv::Point2f>(y0);
+            const cv::Point2f *r1 = undistortMap.ptr<cv::Point2f>(y1);
+            dst[x] = (r0[x0] * (1 - fx) + r0[x1] * fx) * (1 - fy) +
+                     (r1[x0] * (1 - fx) + r1[x1] * fx) * fy;
+        }
+    }
+    cv::convertMaps(map, cv::noArray(), m_remap1, m_remap2, CV_16SC2);
+    qCDebug(lineDetector) << "Remap table rebuilt" << frameSize.width << frameSize.height
+                          << "angle:" << angle << "undistort:" << !intrinsic.empty();
 }
 
 void LineDetector::onTimeout()
@@ -187,9 +598,110 @@ float LineDetector::rotation() const
 
 void LineDetector::setRotation(float angle)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_angle = angle;
 }
 
+bool LineDetector::tracking() const
+{
+    return m_tracking;
+}
+
+void LineDetector::setTracking(bool tracking)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_tracking = tracking;
+}
+
+float LineDetector::trackingWindow() const
+{
+    return m_trackingWindow;
+}
+
+void LineDetector::setTrackingWindow(float trackingWindow)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_trackingWindow = trackingWindow;
+}
+
+LineDetector::Differencing LineDetector::differencing() const
+{
+    return m_differencing;
+}
+
+void LineDetector::setDifferencing(LineDetector::Differencing differencing)
+{
+    const bool released = m_differencing == LaserControlled;
+    {
+        QMutexLocker lock(&m_settingsLock);
+        if (m_differencing == differencing)
+            return;
+        m_differencing = differencing;
+    }
+    // Laser is given back, steadily on with the power others asked for meanwhile
+    if (released)
+        emit laserPowerRequested(m_laserPower >= 0 ? m_laserPower : m_differencingPower);
+    emit differencingChanged();
+}
+
+void LineDetector::setLaserPower(float power)
+{
+    m_laserPower = power;
+    if (m_differencing != LaserControlled)
+        emit laserPowerRequested(power);
+}
+
+void LineDetector::onDifferencingLaserPower(float power)
+{
+    // Queued switches that arrive after LaserControlled was turned off are stale
+    if (m_differencing == LaserControlled)
+        emit laserPowerRequested(power);
+}
+
+int LineDetector::differencingSettleFrames() const
+{
+    return m_differencingSettleFrames;
+}
+
+void LineDetector::setDifferencingSettleFrames(int frames)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_differencingSettleFrames = qMax(0, frames);
+}
+
+float LineDetector::differencingPower() const
+{
+    return m_differencingPower;
+}
+
+void LineDetector::setDifferencingPower(float power)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_differencingPower = qBound(0.0f, power, 1.0f);
+}
+
+int LineDetector::stripes() const
+{
+    return m_stripes;
+}
+
+void LineDetector::setStripes(int stripes)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_stripes = qMax(0, stripes);
+}
+
+bool LineDetector::debugView() const
+{
+    return m_debugView;
+}
+
+void LineDetector::setDebugView(bool debugView)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_debugView = debugView;
+}
+
 float LineDetector::threshold() const
 {
     return m_threshold;
@@ -197,6 +709,7 @@ float LineDetector::threshold() const
 
 void LineDetector::setThreshold(float threshold)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_threshold = threshold;
 }
 
@@ -217,6 +730,7 @@ float LineDetector::integrateTo() const
 
 void LineDetector::setIntegrateTo(float integrateTo)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_integrateTo = integrateTo;
 }
 
@@ -227,6 +741,7 @@ float LineDetector::integrateFrom() const
 
 void LineDetector::setIntegrateFrom(float integrateFrom)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_integrateFrom = integrateFrom;
 }
 
@@ -237,9 +752,21 @@ quint8 LineDetector::valueTo() const
 
 void LineDetector::setValueTo(const quint8 &valueTo)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_valueTo = valueTo;
 }
 
+quint8 LineDetector::chromaRedFrom() const
+{
+    return m_chromaRedFrom;
+}
+
+void LineDetector::setChromaRedFrom(const quint8 &chromaRedFrom)
+{
+    QMutexLocker lock(&m_settingsLock);
+    m_chromaRedFrom = chromaRedFrom;
+}
+
 quint8 LineDetector::valueFrom() const
 {
     return m_valueFrom;
@@ -247,6 +774,7 @@ quint8 LineDetector::valueFrom() const
 
 void LineDetector::setValueFrom(const quint8 &valueFrom)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_valueFrom = valueFrom;
 }
 
@@ -257,6 +785,7 @@ quint8 LineDetector::saturationTo() const
 
 void LineDetector::setSaturationTo(const quint8 &saturationTo)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_saturationTo = saturationTo;
 }
 
@@ -267,6 +796,7 @@ quint8 LineDetector::saturationFrom() const
 
 void LineDetector::setSaturationFrom(const quint8 &saturationFrom)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_saturationFrom = saturationFrom;
 }
 
@@ -277,6 +807,7 @@ quint8 LineDetector::hueHighRangeTo() const
 
 void LineDetector::setHueHighRangeTo(const quint8 &hueHighRangeTo)
 {
+    QMutexLocker lock(&m_settingsLock);
     if (hueHighRangeTo > 179)
         m_hueLowRangeTo = 179;
     else
@@ -290,6 +821,7 @@ quint8 LineDetector::hueHighRangeFrom() const
 
 void LineDetector::setHueHighRangeFrom(const quint8 &hueHighRangeFrom)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_hueHighRangeFrom = hueHighRangeFrom;
 }
 
@@ -300,6 +832,7 @@ quint8 LineDetector::hueLowRangeTo() const
 
 void LineDetector::setHueLowRangeTo(const quint8 &hueLowRangeTo)
 {
+    QMutexLocker lock(&m_settingsLock);
     if (hueLowRangeTo > 179)
         m_hueLowRangeTo = 179;
     else
@@ -313,5 +846,6 @@ quint8 LineDetector::hueLowRangeFrom() const
 
 void LineDetector::setHueLowRangeFrom(const quint8 &hueLowRangeFrom)
 {
+    QMutexLocker lock(&m_settingsLock);
     m_hueLowRangeFrom = hueLowRangeFrom;
 }
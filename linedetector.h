@@ -3,10 +3,108 @@
 
 #include <QObject>
 #include <QLoggingCategory>
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInteger>
+#include <QVector>
+
+#include <opencv2/core.hpp>
+
+#include "beamkernel.h"
+#include "framepool.h"
 
 class CaptureController;
+class LineDetector;
 class QTimer;
 
+/**
+ * @brief The LineDetectorSettings struct Snapshot of LineDetector properties taken for every frame
+ */
+struct LineDetectorSettings {
+    BeamKernel::Thresholds thresholds;
+    BeamKernel::ChromaThresholds chromaThresholds;
+    float integrateFrom;
+    float integrateTo;
+    float threshold;
+    float angle;
+    bool debugView;
+    bool tracking;
+    float trackingWindow;
+    int stripes;
+    int differencing; ///< LineDetector::Differencing
+    int differencingSettleFrames;
+    float differencingPower;
+};
+
+class LineDetectorWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit LineDetectorWorker(LineDetector *lineDetector, CaptureController *captureController, QObject *parent = nullptr);
+
+signals:
+    /**
+     * @brief frameProcessed
+     * @param linesSum Normalized row sums, bottom row first
+     * @param x1 Last row over threshold, -1 if beam wasn't found
+     * @param x2 First row over threshold, -1 if beam wasn't found
+     * @param info Processed frame
+     * @param processedAt When processing was finished, @ref LatencyStatistics::now()
+     */
+    void frameProcessed(const QVector<float> &linesSum, int x1, int x2, const FrameInfo &info, qint64 processedAt);
+    void laserPowerRequested(float power);
+
+public slots:
+    /**
+     * @brief process Takes the newest frame from LineDetector mailbox and integrates it
+     */
+    void process();
+
+private:
+    const cv::Mat &lumaChroma(const cv::Mat &raw, PixelFormat format, int stripes);
+    const cv::Mat *difference(const cv::Mat &frame, quint64 sequence, const LineDetectorSettings &settings);
+    void updateRemap(const cv::Size &frameSize, float angle);
+    void trackingRows(int rows, float trackingWindow, int &rowFrom, int &rowTo);
+    template <typename Body>
+    void runStripes(int stripes, const Body &body);
+    void ensureBuffer(cv::Mat &buffer, int rows, int cols, int type);
+    QVector<float> &linesSumBuffer(int size);
+
+    LineDetector *m_lineDetector;
+    CaptureController *m_captureController;
+
+    int m_trackCenter;
+    int m_trackThickness;
+    int m_trackMisses;
+
+    // Undistort + rotation, fixed-point remap table
+    cv::Mat m_remap1;
+    cv::Mat m_remap2;
+    cv::Size m_remapSize;
+    float m_remapAngle;
+    quint32 m_remapRevision;
+
+    // Persistent buffers, reallocated only on resolution change.
+    // Profiles rotate between worker, queued frameProcessed() calls and LineDetectorDataSource holding the newest,
+    // IntegrationPlot lets go of its copy once it is turned into geometry.
+    enum { LinesSumBuffers = 4 };
+    FrameRef m_frame;
+    cv::Mat m_rotated;
+    QVector<cv::Mat> m_hsvRows;
+    cv::Mat m_ycr;
+    cv::Mat m_debug;
+    QVector<float> m_linesSum[LinesSumBuffers];
+
+    // Laser on/off differencing, previous settled frame is kept as reference
+    int m_differencing;
+    bool m_laserOn;
+    quint64 m_laserSettledFrom;
+    cv::Mat m_reference;
+    quint64 m_referenceSequence;
+    bool m_referenceOn;
+    cv::Mat m_difference;
+};
+
 class LineDetector : public QObject
 {
     Q_OBJECT
@@ -18,14 +116,26 @@ class LineDetector : public QObject
     Q_PROPERTY(quint8 saturationTo READ saturationTo WRITE setSaturationTo NOTIFY hsvThresholdsChanged)
     Q_PROPERTY(quint8 valueFrom READ valueFrom WRITE setValueFrom NOTIFY hsvThresholdsChanged)
     Q_PROPERTY(quint8 valueTo READ valueTo WRITE setValueTo NOTIFY hsvThresholdsChanged)
+    Q_PROPERTY(quint8 chromaRedFrom READ chromaRedFrom WRITE setChromaRedFrom NOTIFY hsvThresholdsChanged)
     Q_PROPERTY(float integrateFrom READ integrateFrom WRITE setIntegrateFrom NOTIFY integrationLimitsChanged)
     Q_PROPERTY(float integrateTo READ integrateTo WRITE setIntegrateTo NOTIFY integrationLimitsChanged)
     Q_PROPERTY(float threshold READ threshold WRITE setThreshold NOTIFY thresholdChanged)
     Q_PROPERTY(State state READ state NOTIFY stateChanged)
     Q_PROPERTY(float dz READ dz NOTIFY dzChanged)
     Q_PROPERTY(float rotation READ rotation WRITE setRotation)
+    Q_PROPERTY(bool debugView READ debugView WRITE setDebugView)
+    Q_PROPERTY(bool tracking READ tracking WRITE setTracking)
+    Q_PROPERTY(float trackingWindow READ trackingWindow WRITE setTrackingWindow)
+    Q_PROPERTY(int stripes READ stripes WRITE setStripes)
+    Q_PROPERTY(quint32 framesProcessed READ framesProcessed NOTIFY countersChanged)
+    Q_PROPERTY(quint32 framesDropped READ framesDropped NOTIFY countersChanged)
+    Q_PROPERTY(quint32 bufferResizes READ bufferResizes NOTIFY countersChanged)
+    Q_PROPERTY(Differencing differencing READ differencing WRITE setDifferencing NOTIFY differencingChanged)
+    Q_PROPERTY(int differencingSettleFrames READ differencingSettleFrames WRITE setDifferencingSettleFrames)
+    Q_PROPERTY(float differencingPower READ differencingPower WRITE setDifferencingPower)
 public:
     explicit LineDetector(CaptureController *captureController, QObject *parent = nullptr);
+    ~LineDetector();
 
     enum State {
         Unlocked,
@@ -35,6 +145,18 @@ public:
     Q_ENUM(State)
     State state() const;
 
+    /**
+     * @brief The Differencing enum Ambient light rejection by subtracting frame with laser off from frame with laser on
+     * Difference is thresholded and integrated instead of the frame, so hue/value limits can be lower and exposure shorter.
+     */
+    enum Differencing {
+        NoDifferencing, ///< Frames are integrated as captured
+        LaserControlled, ///< Laser is switched through laserPowerRequested() after every settled frame,
+                         ///< frames exposed while it was switching are skipped
+        OddFramesOn      ///< Frames already alternate, laser is on in odd sequence numbers (recorded or synthetic pairs)
+    };
+    Q_ENUM(Differencing)
+
     quint8 hueLowRangeFrom() const;
     void setHueLowRangeFrom(const quint8 &hueLowRangeFrom);
 
@@ -59,6 +181,14 @@ public:
     quint8 valueTo() const;
     void setValueTo(const quint8 &valueTo);
 
+    /**
+     * @brief chromaRedFrom Cr lower limit for frames captured in YUYV or NV12
+     * Such frames are thresholded on Y with valueFrom/valueTo and on Cr instead of hue and saturation,
+     * grey frames on Y only.
+     */
+    quint8 chromaRedFrom() const;
+    void setChromaRedFrom(const quint8 &chromaRedFrom);
+
     float integrateFrom() const;
     void setIntegrateFrom(float integrateFrom);
 
@@ -75,6 +205,62 @@ public:
     float rotation() const;
     void setRotation(float angle);
 
+    /**
+     * @brief debugView Process and show whole rotated frame on "second" surface
+     * Full frame is processed only when the surface is active and wants next frame, otherwise and when
+     * disabled only the integration band is remapped and thresholded.
+     */
+    bool debugView() const;
+    void setDebugView(bool debugView);
+
+    /**
+     * @brief tracking Integrate only rows around last beam position while Locked or in Hold
+     * Window is widened twice on every frame without beam until it covers the full frame.
+     * Off by default, so existing setups keep integrating the whole band.
+     */
+    bool tracking() const;
+    void setTracking(bool tracking);
+
+    /**
+     * @brief trackingWindow Tracking window height as a fraction of frame height
+     */
+    float trackingWindow() const;
+    void setTrackingWindow(float trackingWindow);
+
+    /**
+     * @brief stripes Number of row stripes integrated in parallel
+     * 0 uses one stripe per OpenCV worker thread, 1 integrates on detector thread only.
+     */
+    int stripes() const;
+    void setStripes(int stripes);
+
+    Differencing differencing() const;
+    void setDifferencing(Differencing differencing);
+    /**
+     * @brief differencingSettleFrames Frames skipped after laser switch on top of the one already being captured
+     * Covers laser command latency and exposure, LaserControlled mode only.
+     */
+    int differencingSettleFrames() const;
+    void setDifferencingSettleFrames(int frames);
+    /**
+     * @brief differencingPower Laser power of "on" frames
+     * Also left on when LaserControlled is turned off, unless setLaserPower() was called before.
+     */
+    float differencingPower() const;
+    void setDifferencingPower(float power);
+
+    quint32 framesProcessed() const;
+    /**
+     * @brief framesDropped Frames replaced in the mailbox by a newer one before worker got to them
+     */
+    quint32 framesDropped() const;
+    /**
+     * @brief bufferResizes Resizes of detector's own frame and profile buffers, counted in debug builds only
+     * Stays constant after the first frames unless resolution or band changes. Temporaries inside OpenCV
+     * calls and parallel_for_, and Qt queued call events are not seen by it.
+     */
+    quint32 bufferResizes() const;
+
 signals:
     void hsvThresholdsChanged();
     void integrationLimitsChanged();
@@ -85,14 +271,37 @@ signals:
     void dzChanged();
     void dzChanged(float dz);
     void dzValidChanged(bool valid);
+    void countersChanged();
+    void differencingChanged();
+    /**
+     * @brief laserPowerRequested The only laser power source, connect to RayReceiver::setLaserPower()
+     * Carries setLaserPower() requests, or on/off switching while LaserControlled differencing owns the laser.
+     */
+    void laserPowerRequested(float power);
 
 public slots:
+    /**
+     * @brief onFrameReady Puts handle to current frame into single slot mailbox of detector thread
+     * Thread safe, connect with Qt::DirectConnection to avoid queueing frames in the event loop.
+     */
     void onFrameReady();
+    /**
+     * @brief setLaserPower Laser power wanted by others (Automator), connect instead of RayReceiver::setLaserPower()
+     * Held back while LaserControlled differencing switches the laser, last one is sent when it is turned off.
+     * Otherwise on/off labels of frames would go stale whenever both commanded the laser.
+     */
+    void setLaserPower(float power);
 
 private slots:
+    void onDifferencingLaserPower(float power);
     void onTimeout();
+    void onFrameProcessed(const QVector<float> &linesSum, int x1, int x2, const FrameInfo &info, qint64 processedAt);
 
 private:
+    friend class LineDetectorWorker;
+    LineDetectorSettings settings() const;
+    void countBufferResize(int cols, int rows);
+
     CaptureController *m_captureController;
     quint8 m_hueLowRangeFrom;
     quint8 m_hueLowRangeTo;
@@ -102,6 +311,7 @@ private:
     quint8 m_saturationTo;
     quint8 m_valueFrom;
     quint8 m_valueTo;
+    quint8 m_chromaRedFrom;
     float m_integrateFrom;
     float m_integrateTo;
     float m_threshold;
@@ -116,6 +326,26 @@ private:
     float m_lz;
     float m_lx;
     float m_angle;
+    bool m_debugView;
+    bool m_tracking;
+    float m_trackingWindow;
+    int m_stripes;
+    Differencing m_differencing;
+    int m_differencingSettleFrames;
+    float m_differencingPower;
+    float m_laserPower; ///< Last setLaserPower(), negative if none yet
+    mutable QMutex m_settingsLock;
+
+    QThread m_workerThread;
+    LineDetectorWorker *m_worker;
+    int m_consumerId;
+    QMutex m_mailboxLock;
+    FrameRef m_mailbox;
+    bool m_mailboxFull;
+    bool m_processScheduled;
+    QAtomicInteger<quint32> m_framesProcessed;
+    QAtomicInteger<quint32> m_framesDropped;
+    QAtomicInteger<quint32> m_bufferResizes;
 };
 
 Q_DECLARE_LOGGING_CATEGORY(lineDetector)
@@ -1,56 +1,34 @@
 #include "linedetectordatasource.h"
-#include <QDebug>
 
-LineDetectorDataSource::LineDetectorDataSource(QObject *parent) : QObject(parent),
-    m_integratedSeries(nullptr), m_thresholdSeries(nullptr)
+LineDetectorDataSource::LineDetectorDataSource(QObject *parent) : QObject(parent)
 {
 
 }
 
-void LineDetectorDataSource::setIntegratedPlotSeries(QAbstractSeries *series)
+QVector<float> LineDetectorDataSource::profile() const
 {
-    QXYSeries *xySeries = static_cast<QXYSeries *>(series);
-    if (xySeries) {
-        m_integratedSeries = xySeries;
-        connect(xySeries, &QObject::destroyed,
-                this,     &LineDetectorDataSource::integratedSeriesDestroyed);
-    }
+    return m_profile;
 }
 
-void LineDetectorDataSource::setThresholdPlotSeries(QAbstractSeries *series)
+QPointF LineDetectorDataSource::beamFrom() const
 {
-    QXYSeries *xySeries = static_cast<QXYSeries *>(series);
-    if (xySeries) {
-        m_thresholdSeries = xySeries;
-    }
+    return m_beamFrom;
 }
 
-void LineDetectorDataSource::updateIntegratedPlot(const QVector<float> &data)
+QPointF LineDetectorDataSource::beamTo() const
 {
-    if (!m_integratedSeries)
-        return;
-
-    float normalizedStep = 1.0f / data.size();
-    float x = 0.0;
-    QVector<QPointF> points;
-    for (int i = 0; i < data.size(); i++) {
-        points.push_back(QPointF(x, data[i]));
-        x += normalizedStep;
-    }
-    m_integratedSeries->replace(points);
+    return m_beamTo;
 }
 
-void LineDetectorDataSource::drawBeamThickness(const QPointF &pt1, const QPointF &pt2)
+void LineDetectorDataSource::updateIntegratedPlot(const QVector<float> &data)
 {
-    if (!m_thresholdSeries)
-        return;
-    QVector<QPointF> points;
-    points << pt1 << pt2;
-    m_thresholdSeries->replace(points);
+    m_profile = data;
+    emit profileChanged();
 }
 
-void LineDetectorDataSource::integratedSeriesDestroyed()
+void LineDetectorDataSource::drawBeamThickness(const QPointF &pt1, const QPointF &pt2)
 {
-    m_integratedSeries = nullptr;
-    m_thresholdSeries = nullptr;
+    m_beamFrom = pt1;
+    m_beamTo = pt2;
+    emit beamChanged();
 }
@@ -2,31 +2,42 @@
 #define LINEDETECTORDATASOURCE_H
 
 #include <QObject>
-#include <QtCharts/QXYSeries>
-
-QT_CHARTS_USE_NAMESPACE
-
+#include <QPointF>
+#include <QVector>
+
+/**
+ * @brief The LineDetectorDataSource class Latest detector results for plots
+ * Keeps the newest row profile and beam limits only, profile vector is shared with the detector, not copied.
+ * Drawn by IntegrationPlot.
+ */
 class LineDetectorDataSource : public QObject
 {
     Q_OBJECT
 public:
     explicit LineDetectorDataSource(QObject *parent = nullptr);
 
-    Q_INVOKABLE void setIntegratedPlotSeries(QAbstractSeries *series);
-    Q_INVOKABLE void setThresholdPlotSeries(QAbstractSeries *series);
+    /**
+     * @brief profile Normalized row sums, one per image row, plotted at x = row / size
+     */
+    QVector<float> profile() const;
+    /**
+     * @brief beamFrom Beam limits in plot coordinates, x is normalized row, y is row value
+     */
+    QPointF beamFrom() const;
+    QPointF beamTo() const;
 
 signals:
+    void profileChanged();
+    void beamChanged();
 
 public slots:
     void updateIntegratedPlot(const QVector<float> &data);
     void drawBeamThickness(const QPointF &pt1, const QPointF &pt2);
 
-private slots:
-    void integratedSeriesDestroyed();
-
 private:
-    QXYSeries *m_integratedSeries;
-    QXYSeries *m_thresholdSeries;
+    QVector<float> m_profile;
+    QPointF m_beamFrom;
+    QPointF m_beamTo;
 };
 
 #endif // LINEDETECTORDATASOURCE_H
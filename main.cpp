@@ -7,9 +7,14 @@
 #include "cameracalibrator.h"
 #include "linedetector.h"
 #include "linedetectordatasource.h"
+#include "integrationplot.h"
 #include "gcodeplayer.h"
 #include "rayreceiver.h"
 #include "automator.h"
+#include "latencystatistics.h"
+#include "sessionrecorder.h"
+#include "sessionplayer.h"
+#include "threadtuning.h"
 
 int main(int argc, char *argv[])
 {
@@ -22,16 +27,29 @@ int main(int argc, char *argv[])
     qmlRegisterType<CVMatSurfaceSource>("io.opencv", 1, 0, "CVMatSurfaceSource");
     //qmlRegisterType<CaptureController>("io.opencv", 1, 0, "CaptureController");
 
-    CaptureController captureController;
+    LatencyStatistics latencyStatistics;
+    engine.rootContext()->setContextProperty("latencyStatistics", &latencyStatistics);
+
+    qmlRegisterUncreatableType<CaptureController>("tech.vhrd.vision", 1, 0, "CaptureController", "Only for enums");
+    // Beam camera, the detector pipeline and LatencyStatistics belong to it
+    CaptureController captureController("main");
+    // Workpiece inspection camera, runs on its own thread next to the beam camera
+    CaptureController inspectionCapture("inspection");
+    inspectionCapture.setRecordLatency(false);
+
+    QStringList threadRoles("detector");
+    foreach (const QString &name, CaptureController::names())
+        threadRoles.append("capture_" + name);
+    ThreadTuning::report(threadRoles);
 
     CameraCalibrator cameraCalibrator(&captureController);
-    QObject::connect(&captureController, &CaptureController::frameReady,
-                     &cameraCalibrator,  &CameraCalibrator::onFrameReady);
 
     qmlRegisterUncreatableType<LineDetector>("tech.vhrd.vision", 1, 0, "LineDetector", "Only for enums");
     LineDetector lineDetector(&captureController);
     QObject::connect(&captureController, &CaptureController::frameReady,
-                     &lineDetector,      &LineDetector::onFrameReady);
+                     &lineDetector,      &LineDetector::onFrameReady, Qt::DirectConnection);
+    qmlRegisterUncreatableType<LineDetectorDataSource>("tech.vhrd.vision", 1, 0, "LineDetectorDataSource", "Use lineDetectorDataSource");
+    qmlRegisterType<IntegrationPlot>("tech.vhrd.vision", 1, 0, "IntegrationPlot");
     LineDetectorDataSource lineDetectorDataSource;
     QObject::connect(&lineDetector,           &LineDetector::integrationComplete,
                      &lineDetectorDataSource, &LineDetectorDataSource::updateIntegratedPlot);
@@ -39,6 +57,7 @@ int main(int argc, char *argv[])
                      &lineDetectorDataSource, &LineDetectorDataSource::drawBeamThickness);
 
     engine.rootContext()->setContextProperty("captureController", &captureController);
+    engine.rootContext()->setContextProperty("inspectionCapture", &inspectionCapture);
     engine.rootContext()->setContextProperty("cameraCalibrator", &cameraCalibrator);
     engine.rootContext()->setContextProperty("lineDetector", &lineDetector);
     engine.rootContext()->setContextProperty("lineDetectorDataSource", &lineDetectorDataSource);
@@ -67,7 +86,10 @@ int main(int argc, char *argv[])
                      &automator,    &Automator::onCoordsChanged);
     QObject::connect(&receiver,     &RayReceiver::connectionStateChanged,
                      &automator,    &Automator::onRayConnectionStateChanged);
+    // Detector owns the laser while it switches it for differencing, Automator power goes through it
     QObject::connect(&automator,    &Automator::changePower,
+                     &lineDetector, &LineDetector::setLaserPower);
+    QObject::connect(&lineDetector, &LineDetector::laserPowerRequested,
                      &receiver,     &RayReceiver::setLaserPower);
     QObject::connect(&automator,    &Automator::sendToMC,
                      &player,       &GcodePlayer::send);
@@ -77,6 +99,10 @@ int main(int argc, char *argv[])
                      &automator,    &Automator::answerFromMCReceived);
     QObject::connect(&captureController,     &CaptureController::cameraFail,
                      &automator,    &Automator::onCameraFail);
+    // Automator declares the beam camera rate it needs, full rate only while dz is about to be taken
+    QObject::connect(&automator,         &Automator::captureRateRequested,
+                     &captureController, [&](float fps) { captureController.setRequestedRate("automator", fps); });
+    captureController.setRequestedRate("automator", automator.requestedCaptureRate());
     QObject::connect(&automator,     &Automator::startScan,
                      &player,    &GcodePlayer::startFile);
     QObject::connect(&player,     &GcodePlayer::stateChanged,
@@ -86,6 +112,29 @@ int main(int argc, char *argv[])
     QObject::connect(&player,     &GcodePlayer::stateChanged,
                      &automator,    &Automator::scanFinished);
 
+    SessionRecorder sessionRecorder(&captureController);
+    engine.rootContext()->setContextProperty("sessionRecorder", &sessionRecorder);
+    QObject::connect(&captureController, &CaptureController::frameReady,
+                     &sessionRecorder,   &SessionRecorder::onFrameReady, Qt::DirectConnection);
+    QObject::connect(&receiver,          &RayReceiver::coordsChanged,
+                     &sessionRecorder,   &SessionRecorder::onCoordsChanged);
+    QObject::connect(&receiver,          &RayReceiver::stateChanged,
+                     &sessionRecorder,   &SessionRecorder::onRayStateChanged);
+    QObject::connect(&player,            &GcodePlayer::currentLineChanged,
+                     &sessionRecorder,   [&]() { sessionRecorder.onGcodeLineChanged(player.currentLineNumber()); });
+    QObject::connect(&player,            &GcodePlayer::stateChanged,
+                     &sessionRecorder,   &SessionRecorder::onGcodeStateChanged);
+    QObject::connect(&lineDetector,      QOverload<float>::of(&LineDetector::dzChanged),
+                     &sessionRecorder,   &SessionRecorder::onDzChanged);
+    QObject::connect(&lineDetector,      &LineDetector::dzValidChanged,
+                     &sessionRecorder,   &SessionRecorder::onDzValidChanged);
+
+    SessionPlayer sessionPlayer(&captureController);
+    engine.rootContext()->setContextProperty("sessionPlayer", &sessionPlayer);
+    // Replayed telemetry is not connected to Automator: it would compensate and set laser power
+    // on the real machine. Replayed frames give the detector's own dz, recorded dz and G-code line are
+    // sessionPlayer properties to compare it with.
+
     const QUrl url(QStringLiteral("qrc:/main.qml"));
     QObject::connect(&engine, &QQmlApplicationEngine::objectCreated,
                      &app, [url](QObject *obj, const QUrl &objUrl) {
@@ -7,7 +7,6 @@ import io.opencv 1.0
 import tech.vhrd.vision 1.0
 import tech.vhrd 1.0
 import tech.vhrd.automator 1.0
-import QtCharts 2.2
 import QtQuick.Dialogs 1.2
 
 Window {
@@ -31,6 +30,23 @@ Window {
         height: parent.height / 2
         source: CVMatSurfaceSource {
             name: "main"
+            active: mainVideoOutput.visible && root.visibility !== Window.Minimized
+            displaySize: Qt.size(mainVideoOutput.width * Screen.devicePixelRatio, mainVideoOutput.height * Screen.devicePixelRatio)
+        }
+    }
+
+    VideoOutput {
+        id: inspectionVideoOutput
+        anchors.right: mainVideoOutput.right
+        anchors.top: mainVideoOutput.top
+        anchors.margins: 8
+        width: mainVideoOutput.width / 3
+        height: mainVideoOutput.height / 3
+        visible: inspectionCapture.status === CaptureController.Started
+        source: CVMatSurfaceSource {
+            name: "inspection"
+            active: inspectionVideoOutput.visible && root.visibility !== Window.Minimized
+            displaySize: Qt.size(inspectionVideoOutput.width * Screen.devicePixelRatio, inspectionVideoOutput.height * Screen.devicePixelRatio)
         }
     }
 
@@ -43,6 +59,8 @@ Window {
         source: CVMatSurfaceSource {
             id: secondVideoSource
             name: "second"
+            active: secondVideoOutput.visible && root.visibility !== Window.Minimized
+            displaySize: Qt.size(secondVideoOutput.width * Screen.devicePixelRatio, secondVideoOutput.height * Screen.devicePixelRatio)
         }
         onWidthChanged: osdRescale(testRect, secondVideoSource, secondVideoOutput)
         onHeightChanged: osdRescale(testRect, secondVideoSource, secondVideoOutput)
@@ -153,6 +171,25 @@ Window {
                     }
                 }
             }
+            RowLayout {
+                Layout.maximumHeight: 24
+                Text {
+                    text: "Chroma red from:"
+                    color: "gray"
+                    Layout.preferredWidth: settingsLayout.width * 0.4
+                }
+
+                Slider {
+                    from: 128
+                    to: 255
+                    stepSize: 1
+                    value: 150
+                    onMoved: lineDetector.chromaRedFrom = Math.floor(value)
+                    Component.onCompleted: {
+                        lineDetector.chromaRedFrom = Math.floor(value)
+                    }
+                }
+            }
             RowLayout {
                 Layout.maximumHeight: 24
                 Text {
@@ -222,7 +259,7 @@ Window {
             }
         }
 
-        ChartView {
+        IntegrationPlot {
             height: parent.width * 0.3
             width: parent.height + 112
             rotation: -90
@@ -231,49 +268,10 @@ Window {
             anchors.right: parent.right
             anchors.rightMargin: -54
             transformOrigin: Item.BottomRight
-            animationOptions: ChartView.NoAnimation
-            backgroundColor: "transparent"
-            legend.visible: false
-            //antialiasing: true
-
-            ValueAxis {
-                id: axisX
-                min: 0
-                max: 1
-
-                gridVisible: false
-                lineVisible: false
-                labelsVisible: false
-            }
-            ValueAxis {
-                id: axisY
-                min: 0
-                max: 1
-                gridVisible: false
-                lineVisible: false
-                labelsVisible: false
-            }
-            LineSeries {
-                id: integratedPlotSeries
-                name: "test"
-                axisX: axisX
-                axisY: axisY
-                useOpenGL: true
-                width: 1.0
-            }
-            LineSeries {
-                id: thresholdPlotSeries
-                axisX: axisX
-                axisY: axisY
-                useOpenGL: true
-                width: 2.0
-                color: "red"
-            }
-
-            Component.onCompleted: {
-                lineDetectorDataSource.setIntegratedPlotSeries(integratedPlotSeries)
-                lineDetectorDataSource.setThresholdPlotSeries(thresholdPlotSeries)
-            }
+            source: lineDetectorDataSource
+            refreshRate: 30
+            lineWidth: 1.0
+            beamColor: "red"
         }
 
         Text {
@@ -833,6 +831,16 @@ Window {
             }
         }
 
+        Button {
+            text: "Inspection"
+            onClicked: {
+                if (inspectionCapture.status === CaptureController.Started)
+                    inspectionCapture.stop()
+                else
+                    inspectionCapture.start("1")
+            }
+        }
+
         Button {
             text: "Take pic"
             onClicked: cameraCalibrator.takePicture()
@@ -0,0 +1,249 @@
+#include "mjpegclient.h"
+
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <opencv2/imgcodecs.hpp>
+
+namespace {
+// Far above any JPEG a camera sends, guards capture thread memory against broken or hostile streams
+enum { MaxPartSize = 8 * 1024 * 1024 };
+// Blocking waits are split into slices this long, so cancel() is seen well before CaptureController::stop() gives up
+enum { WaitSlice = 100 };
+}
+
+MjpegClient::MjpegClient() :
+    m_socket(nullptr), m_timeout(3000), m_boundarySeen(false), m_cancelled(0)
+{
+}
+
+MjpegClient::~MjpegClient()
+{
+    close();
+}
+
+bool MjpegClient::open(const QUrl &url, int timeout)
+{
+    close();
+    m_timeout = timeout;
+    m_socket = new QTcpSocket;
+    m_socket->connectToHost(url.host(), url.port(80));
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_socket->waitForConnected(WaitSlice)) {
+        if (m_cancelled.load() || m_socket->state() == QAbstractSocket::UnconnectedState ||
+                timer.elapsed() >= m_timeout) {
+            m_error = m_cancelled.load() ? QString("Cancelled") : m_socket->errorString();
+            close();
+            return false;
+        }
+    }
+
+    // HTTP/1.0, so server doesn't switch to chunked encoding
+    QByteArray request = "GET " + url.path(QUrl::FullyEncoded).toLatin1();
+    if (url.path().isEmpty())
+        request += "/";
+    if (url.hasQuery())
+        request += "?" + url.query(QUrl::FullyEncoded).toLatin1();
+    request += " HTTP/1.0\r\nHost: " + url.host().toLatin1() + "\r\n";
+    if (!url.userInfo().isEmpty())
+        request += "Authorization: Basic " + url.userInfo(QUrl::FullyDecoded).toUtf8().toBase64() + "\r\n";
+    request += "\r\n";
+    m_socket->write(request);
+
+    QByteArray line;
+    if (!readLine(line) || !line.startsWith("HTTP/") || line.split(' ').value(1) != "200") {
+        m_error = m_error.isEmpty() ? QString("Unexpected response: %1").arg(QString(line.trimmed())) : m_error;
+        close();
+        return false;
+    }
+    while (readLine(line) && !line.trimmed().isEmpty()) {
+        if (!line.toLower().startsWith("content-type:"))
+            continue;
+        int i = line.toLower().indexOf("boundary=");
+        if (i < 0)
+            continue;
+        QByteArray boundary = line.mid(i + 9).trimmed();
+        int end = boundary.indexOf(';');
+        if (end >= 0)
+            boundary.truncate(end);
+        boundary.replace('"', "");
+        if (boundary.startsWith("--"))
+            boundary.remove(0, 2);
+        m_boundary = "--" + boundary;
+    }
+    if (m_boundary.isEmpty()) {
+        m_error = "Not a multipart stream";
+        close();
+        return false;
+    }
+    m_boundarySeen = false;
+    return true;
+}
+
+void MjpegClient::close()
+{
+    delete m_socket;
+    m_socket = nullptr;
+    m_boundary.clear();
+}
+
+bool MjpegClient::isOpened() const
+{
+    return m_socket != nullptr;
+}
+
+QString MjpegClient::errorString() const
+{
+    return m_error;
+}
+
+void MjpegClient::cancel()
+{
+    m_cancelled.store(1);
+}
+
+bool MjpegClient::readFrame(QByteArray &jpeg)
+{
+    if (!m_socket)
+        return false;
+
+    QByteArray line;
+    if (m_boundarySeen) { // rest of boundary line, left by previous part without Content-Length
+        if (!readLine(line))
+            return false;
+        m_boundarySeen = false;
+    } else {
+        do {
+            if (!readLine(line))
+                return false;
+        } while (!line.startsWith(m_boundary));
+    }
+
+    qint64 length = -1;
+    while (true) {
+        if (!readLine(line))
+            return false;
+        line = line.trimmed();
+        if (line.isEmpty())
+            break;
+        if (line.toLower().startsWith("content-length:"))
+            length = line.mid(15).trimmed().toLongLong();
+    }
+
+    if (length > MaxPartSize) {
+        // Broken part, it is left unread and the next call resynchronizes on the boundary
+        qWarning() << "MJPEG part of" << length << "bytes is over the limit, skipped";
+        jpeg.clear();
+        return true;
+    }
+    if (length >= 0) {
+        jpeg.resize(length);
+        return readBytes(jpeg.data(), length);
+    }
+
+    // No length, read until next boundary, it may be split between reads
+    const QByteArray marker = "\r\n" + m_boundary;
+    jpeg.clear();
+    bool oversized = false;
+    while (true) {
+        if (m_socket->bytesAvailable() == 0 && !waitForData())
+            return false;
+        QByteArray chunk = m_socket->peek(m_socket->bytesAvailable());
+        int keep = qMin(jpeg.size(), marker.size() - 1);
+        int pos = (jpeg.right(keep) + chunk).indexOf(marker);
+        if (pos < 0) {
+            jpeg.append(m_socket->read(chunk.size()));
+            if (jpeg.size() > MaxPartSize) {
+                // Only the tail a split marker may start in is kept, the part is dropped once it ends
+                jpeg = jpeg.right(marker.size() - 1);
+                oversized = true;
+            }
+            continue;
+        }
+        int data = pos - keep;
+        if (data < 0)
+            jpeg.chop(-data);
+        else
+            jpeg.append(m_socket->read(data));
+        m_socket->read(qMin(data, 0) + marker.size());
+        m_boundarySeen = true;
+        if (oversized) {
+            qWarning() << "MJPEG part without length is over the limit, skipped";
+            jpeg.clear();
+        }
+        return true;
+    }
+}
+
+bool MjpegClient::decode(const QByteArray &jpeg, cv::Mat &frame, int scale, const QRectF &region, bool grey)
+{
+    int flags = grey ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+    if (scale == 2)
+        flags = grey ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+    else if (scale == 4)
+        flags = grey ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+    else if (scale == 8)
+        flags = grey ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+    const cv::Mat buffer(1, jpeg.size(), CV_8UC1, const_cast<char *>(jpeg.constData()));
+
+    if (region.isEmpty()) {
+        cv::imdecode(buffer, flags, &frame);
+        return !frame.empty();
+    }
+    // Decoder has no partial output, decode into scratch and keep only the region
+    thread_local cv::Mat decoded;
+    cv::imdecode(buffer, flags, &decoded);
+    if (decoded.empty())
+        return false;
+    cv::Rect rect(region.x() * decoded.cols, region.y() * decoded.rows,
+                  region.width() * decoded.cols, region.height() * decoded.rows);
+    rect &= cv::Rect(0, 0, decoded.cols, decoded.rows);
+    if (rect.empty())
+        return false;
+    decoded(rect).copyTo(frame);
+    return true;
+}
+
+bool MjpegClient::readLine(QByteArray &line)
+{
+    while (!m_socket->canReadLine()) {
+        if (!waitForData())
+            return false;
+    }
+    line = m_socket->readLine();
+    return true;
+}
+
+bool MjpegClient::readBytes(char *data, qint64 size)
+{
+    while (size > 0) {
+        if (m_socket->bytesAvailable() == 0 && !waitForData())
+            return false;
+        qint64 n = m_socket->read(data, size);
+        if (n < 0) {
+            m_error = m_socket->errorString();
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool MjpegClient::waitForData()
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_cancelled.load()) {
+        if (m_socket->waitForReadyRead(WaitSlice))
+            return true;
+        if (m_socket->state() != QAbstractSocket::ConnectedState || timer.elapsed() >= m_timeout) {
+            m_error = m_socket->errorString();
+            return false;
+        }
+    }
+    m_error = "Cancelled";
+    return false;
+}
@@ -0,0 +1,65 @@
+#ifndef MJPEGCLIENT_H
+#define MJPEGCLIENT_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QRectF>
+#include <QString>
+#include <QUrl>
+
+#include <opencv2/core.hpp>
+
+class QTcpSocket;
+
+/**
+ * @brief The MjpegClient class Blocking reader of multipart/x-mixed-replace JPEG streams over HTTP
+ * Used from capture thread instead of cv::VideoCapture, so every part can be decoded at reduced size,
+ * cropped or not decoded at all when consumers are behind. Works with mjpg-streamer and any server
+ * sending parts with or without Content-Length.
+ */
+class MjpegClient
+{
+public:
+    MjpegClient();
+    ~MjpegClient();
+
+    bool open(const QUrl &url, int timeout = 3000);
+    void close();
+    bool isOpened() const;
+    QString errorString() const;
+
+    /**
+     * @brief cancel Makes blocking open() and readFrame() return false within 100 ms, thread safe
+     * Cancelled client stays cancelled, capture thread can quit without being terminated.
+     */
+    void cancel();
+
+    /**
+     * @brief readFrame Reads next JPEG from the stream, blocks until it arrives
+     * @param jpeg Compressed frame, buffer is reused, empty for a part over 8 MB which is skipped
+     * @return false on disconnect or timeout
+     */
+    bool readFrame(QByteArray &jpeg);
+
+    /**
+     * @brief decode Decodes JPEG into BGR frame
+     * @param scale 1, 2, 4 or 8, reduced scales are decoded directly at lower resolution (DCT scaling)
+     * @param region Normalized part of the frame to keep, empty or null for whole frame
+     * @param grey Decode luma only into single channel frame, chroma is neither decoded nor converted
+     */
+    static bool decode(const QByteArray &jpeg, cv::Mat &frame, int scale, const QRectF &region, bool grey = false);
+
+private:
+    bool readLine(QByteArray &line);
+    bool readBytes(char *data, qint64 size);
+    bool waitForData();
+
+    QTcpSocket *m_socket;
+    QByteArray m_boundary;
+    QString m_error;
+    int m_timeout;
+    bool m_boundarySeen;
+    QAtomicInteger<int> m_cancelled;
+};
+
+#endif // MJPEGCLIENT_H
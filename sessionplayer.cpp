@@ -0,0 +1,334 @@
+#include "sessionplayer.h"
+
+#include <QTimer>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "capturecontroller.hpp"
+#include "latencystatistics.h"
+
+SessionPlayer::SessionPlayer(CaptureController *captureController, QObject *parent) : QObject(parent),
+    m_captureController(captureController), m_data(nullptr), m_start(0), m_next(0), m_position(0),
+    m_recordedDz(0), m_recordedDzValid(false), m_gcodeLine(-1)
+{
+    m_timer = new QTimer(this);
+    m_timer->setInterval(5);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, &QTimer::timeout,
+            this,    &SessionPlayer::onTimeout);
+}
+
+SessionPlayer::~SessionPlayer()
+{
+    close();
+}
+
+bool SessionPlayer::open(const QString &filename)
+{
+    close();
+    m_file.setFileName(filename);
+    if (!m_file.open(QFile::ReadOnly)) {
+        qCWarning(session) << "Can't open" << filename << m_file.errorString();
+        return false;
+    }
+    qint64 size = m_file.size();
+    m_data = m_file.map(0, size);
+    if (!m_data) {
+        qCWarning(session) << "Can't map" << filename << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+    const Session::FileHeader *header = reinterpret_cast<const Session::FileHeader *>(m_data);
+    if (size < qint64(sizeof(Session::FileHeader)) ||
+            memcmp(header->magic, Session::fileMagic, sizeof(header->magic)) != 0 ||
+            header->version != Session::version) {
+        qCWarning(session) << filename << "is not a session file";
+        close();
+        return false;
+    }
+    if (!loadIndex(size)) {
+        qCWarning(session) << filename << "has no records";
+        close();
+        return false;
+    }
+    // Frames carry grab time and are queued after it, so file order is only nearly sorted
+    std::stable_sort(m_index.begin(), m_index.end(), [](const Session::IndexEntry &a, const Session::IndexEntry &b) {
+        return a.timestamp < b.timestamp;
+    });
+    m_start = m_index.first().timestamp;
+    m_next = 0;
+    m_position = 0;
+    qCDebug(session) << "Opened" << filename << m_index.size() << "records," << duration() << "ms";
+    emit openedChanged();
+    emit positionChanged();
+    return true;
+}
+
+bool SessionPlayer::loadIndex(qint64 size)
+{
+    m_index.clear();
+    const qint64 footerOffset = size - qint64(sizeof(Session::Footer));
+    if (footerOffset >= qint64(sizeof(Session::FileHeader))) {
+        const Session::Footer *footer = reinterpret_cast<const Session::Footer *>(m_data + footerOffset);
+        if (memcmp(footer->magic, Session::indexMagic, sizeof(footer->magic)) == 0 &&
+                footer->count <= quint64(footerOffset) / sizeof(Session::IndexEntry) &&
+                footer->indexOffset + footer->count * sizeof(Session::IndexEntry) == quint64(footerOffset)) {
+            const Session::IndexEntry *entries = reinterpret_cast<const Session::IndexEntry *>(m_data + footer->indexOffset);
+            m_index.reserve(footer->count);
+            // Index is trusted only if every entry points at a complete record of the same type
+            bool valid = true;
+            for (quint64 i = 0; i < footer->count && valid; ++i) {
+                valid = recordValid(entries[i].offset, size) &&
+                        reinterpret_cast<const Session::RecordHeader *>(m_data + entries[i].offset)->type == entries[i].type;
+                m_index.append(entries[i]);
+            }
+            if (valid)
+                return !m_index.isEmpty();
+            qCWarning(session) << "Index is corrupted";
+            m_index.clear();
+        }
+    }
+
+    // Recording was interrupted, walk the records and ignore the last incomplete one
+    qCDebug(session) << "No index, scanning records";
+    qint64 offset = sizeof(Session::FileHeader);
+    while (offset + qint64(sizeof(Session::RecordHeader)) <= size) {
+        const Session::RecordHeader *header = reinterpret_cast<const Session::RecordHeader *>(m_data + offset);
+        if (header->type < Session::Frame || header->type > Session::DzValid ||
+                offset + qint64(sizeof(Session::RecordHeader)) + header->size > size)
+            break;
+        if (!recordValid(offset, size)) {
+            // Record fits but its payload doesn't, it is skipped rather than played
+            offset += sizeof(Session::RecordHeader) + header->size;
+            continue;
+        }
+        Session::IndexEntry entry;
+        entry.timestamp = header->timestamp;
+        entry.offset = offset;
+        entry.type = header->type;
+        entry.reserved = 0;
+        m_index.append(entry);
+        offset += sizeof(Session::RecordHeader) + header->size;
+    }
+    return !m_index.isEmpty();
+}
+
+bool SessionPlayer::recordValid(quint64 offset, qint64 size) const
+{
+    // Records are 8 byte aligned, payloads are used in place
+    if (offset < sizeof(Session::FileHeader) || offset % 8 != 0 || offset > quint64(size) ||
+            offset + sizeof(Session::RecordHeader) > quint64(size))
+        return false;
+    const Session::RecordHeader *header = reinterpret_cast<const Session::RecordHeader *>(m_data + offset);
+    if (offset + sizeof(Session::RecordHeader) + header->size > quint64(size))
+        return false;
+
+    const uchar *payload = m_data + offset + sizeof(Session::RecordHeader);
+    switch (header->type) {
+    case Session::Frame: {
+        if (header->size < sizeof(Session::FramePayload))
+            return false;
+        const Session::FramePayload *frame = reinterpret_cast<const Session::FramePayload *>(payload);
+        if (frame->rows <= 0 || frame->cols <= 0 || (frame->type & ~CV_MAT_TYPE_MASK) != 0 ||
+                frame->format < qint32(PixelFormat::BGR) || frame->format > qint32(PixelFormat::Grey))
+            return false;
+        const quint64 pixels = quint64(frame->rows) * quint64(frame->cols) * CV_ELEM_SIZE(frame->type);
+        return pixels <= header->size - sizeof(Session::FramePayload);
+    }
+    case Session::Coords:
+        return header->size >= 4 * sizeof(float);
+    case Session::RayState:
+    case Session::GcodeLine:
+    case Session::GcodeState:
+    case Session::Dz:
+    case Session::DzValid:
+        return header->size >= sizeof(qint32);
+    default:
+        return false;
+    }
+}
+
+void SessionPlayer::close()
+{
+    if (!m_data)
+        return;
+    pause();
+    m_file.unmap(const_cast<uchar *>(m_data));
+    m_file.close();
+    m_data = nullptr;
+    m_index.clear();
+    m_next = 0;
+    m_position = 0;
+    m_recordedDz = 0;
+    m_recordedDzValid = false;
+    m_gcodeLine = -1;
+    emit openedChanged();
+    emit positionChanged();
+    emit recordedDzChanged(m_recordedDz);
+    emit recordedDzValidChanged(m_recordedDzValid);
+    emit gcodeLineChanged(m_gcodeLine);
+}
+
+bool SessionPlayer::opened() const
+{
+    return m_data != nullptr;
+}
+
+bool SessionPlayer::playing() const
+{
+    return m_timer->isActive();
+}
+
+qint64 SessionPlayer::duration() const
+{
+    if (m_index.isEmpty())
+        return 0;
+    return (m_index.last().timestamp - m_start) / 1000000;
+}
+
+qint64 SessionPlayer::position() const
+{
+    return positionNs() / 1000000;
+}
+
+float SessionPlayer::recordedDz() const
+{
+    return m_recordedDz;
+}
+
+bool SessionPlayer::recordedDzValid() const
+{
+    return m_recordedDzValid;
+}
+
+int SessionPlayer::gcodeLine() const
+{
+    return m_gcodeLine;
+}
+
+qint64 SessionPlayer::positionNs() const
+{
+    if (playing())
+        return m_position + m_clock.nsecsElapsed();
+    return m_position;
+}
+
+void SessionPlayer::play()
+{
+    if (!m_data || playing())
+        return;
+    if (m_captureController->status() != CaptureController::Status::Stopped)
+        qCWarning(session) << "Capture is running, recorded frames won't be shown";
+    if (m_next >= m_index.size())
+        seek(0);
+    m_clock.start();
+    m_timer->start();
+    emit playingChanged();
+}
+
+void SessionPlayer::pause()
+{
+    if (!playing())
+        return;
+    m_position = positionNs();
+    m_timer->stop();
+    emit playingChanged();
+}
+
+void SessionPlayer::seek(qint64 position)
+{
+    if (!m_data)
+        return;
+    m_position = qBound<qint64>(0, position, duration()) * 1000000;
+    if (playing())
+        m_clock.restart();
+
+    Session::IndexEntry key;
+    key.timestamp = m_start + m_position;
+    auto it = std::upper_bound(m_index.constBegin(), m_index.constEnd(), key,
+                               [](const Session::IndexEntry &a, const Session::IndexEntry &b) {
+        return a.timestamp < b.timestamp;
+    });
+    m_next = it - m_index.constBegin();
+
+    // Restore state as it was at this moment: newest record of every type before the position
+    // (newest frame is shown too), in original order
+    QVector<int> latest(Session::DzValid + 1, -1);
+    for (int i = m_next - 1, found = 0; i >= 0 && found < Session::DzValid; --i) {
+        quint32 type = m_index[i].type;
+        if (type <= Session::DzValid && latest[type] < 0) {
+            latest[type] = i;
+            found++;
+        }
+    }
+    std::sort(latest.begin(), latest.end());
+    m_captureController->resetCounters();
+    foreach (int i, latest) {
+        if (i >= 0)
+            dispatch(m_index[i]);
+    }
+    emit positionChanged();
+}
+
+void SessionPlayer::onTimeout()
+{
+    const qint64 now = m_start + positionNs();
+    bool dispatched = false;
+    while (m_next < m_index.size() && m_index[m_next].timestamp <= now) {
+        dispatch(m_index[m_next++]);
+        dispatched = true;
+    }
+    if (dispatched)
+        emit positionChanged();
+    if (m_next >= m_index.size()) {
+        pause();
+        emit finished();
+    }
+}
+
+void SessionPlayer::dispatch(const Session::IndexEntry &entry)
+{
+    const uchar *payload = m_data + entry.offset + sizeof(Session::RecordHeader);
+    switch (entry.type) {
+    case Session::Frame: {
+        const Session::FramePayload *header = reinterpret_cast<const Session::FramePayload *>(payload);
+        // Only read from, copied into frame pool by injectFrame()
+        const cv::Mat frame(header->rows, header->cols, header->type,
+                            const_cast<uchar *>(payload + sizeof(Session::FramePayload)));
+        FrameInfo info;
+        info.sequence = header->sequence;
+        info.timestamp = LatencyStatistics::now(); // latency is measured from playback
+        info.cameraTimestamp = header->cameraTimestamp;
+        info.format = static_cast<PixelFormat>(header->format);
+        m_captureController->injectFrame(frame, info);
+        break;
+    }
+    case Session::Coords: {
+        const float *c = reinterpret_cast<const float *>(payload);
+        emit coordsChanged(c[0], c[1], c[2], c[3]);
+        break;
+    }
+    case Session::RayState:
+        emit stateChanged(static_cast<RayReceiver::State>(*reinterpret_cast<const qint32 *>(payload)));
+        break;
+    case Session::GcodeLine:
+        m_gcodeLine = *reinterpret_cast<const qint32 *>(payload);
+        emit gcodeLineChanged(m_gcodeLine);
+        break;
+    case Session::GcodeState:
+        emit gcodeStateChanged(static_cast<GcodePlayer::State>(*reinterpret_cast<const qint32 *>(payload)));
+        break;
+    case Session::Dz:
+        m_recordedDz = *reinterpret_cast<const float *>(payload);
+        emit recordedDzChanged(m_recordedDz);
+        break;
+    case Session::DzValid:
+        m_recordedDzValid = *reinterpret_cast<const qint32 *>(payload) != 0;
+        emit recordedDzValidChanged(m_recordedDzValid);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef SESSIONPLAYER_H
+#define SESSIONPLAYER_H
+
+#include <QObject>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "sessionrecorder.h"
+#include "rayreceiver.h"
+#include "gcodeplayer.h"
+
+class CaptureController;
+class QTimer;
+
+/**
+ * @brief The SessionPlayer class Plays a file written by SessionRecorder back in real time
+ * File is memory mapped, frames are published through CaptureController::injectFrame() so the detector
+ * and views process them as live ones (capture must be stopped), RayReceiver telemetry is emitted with the
+ * same signatures for views only. Nothing played back may reach Automator, its reactions command the real machine
+ * and laser. Recorded GcodePlayer events and dz are emitted on replay-only signals, so the dz the detector
+ * computes again from replayed frames can be compared with the one recorded in the field.
+ */
+class SessionPlayer : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool opened READ opened NOTIFY openedChanged)
+    Q_PROPERTY(bool playing READ playing NOTIFY playingChanged)
+    Q_PROPERTY(qint64 duration READ duration NOTIFY openedChanged)
+    Q_PROPERTY(qint64 position READ position WRITE seek NOTIFY positionChanged)
+    Q_PROPERTY(float recordedDz READ recordedDz NOTIFY recordedDzChanged)
+    Q_PROPERTY(bool recordedDzValid READ recordedDzValid NOTIFY recordedDzValidChanged)
+    Q_PROPERTY(int gcodeLine READ gcodeLine NOTIFY gcodeLineChanged)
+public:
+    explicit SessionPlayer(CaptureController *captureController, QObject *parent = nullptr);
+    ~SessionPlayer();
+
+    Q_INVOKABLE bool open(const QString &filename);
+    Q_INVOKABLE void close();
+    bool opened() const;
+
+    bool playing() const;
+
+    /**
+     * @brief duration Session length in ms
+     */
+    qint64 duration() const;
+    /**
+     * @brief position Playback position in ms from session start
+     */
+    qint64 position() const;
+
+    /**
+     * @brief recordedDz Dz as it was recorded at current position, not the one computed from replayed frames
+     */
+    float recordedDz() const;
+    bool recordedDzValid() const;
+    /**
+     * @brief gcodeLine Recorded GcodePlayer line, -1 if none yet
+     */
+    int gcodeLine() const;
+
+public slots:
+    void play();
+    void pause();
+    /**
+     * @brief seek Jumps to position in ms, last telemetry and frame before it are emitted again
+     */
+    void seek(qint64 position);
+
+signals:
+    void openedChanged();
+    void playingChanged();
+    void positionChanged();
+    void finished();
+
+    void coordsChanged(float x, float y, float z, float b);
+    void stateChanged(RayReceiver::State s);
+
+    // Replay only, never connected to GcodePlayer or Automator
+    void gcodeLineChanged(int line);
+    void gcodeStateChanged(GcodePlayer::State s);
+    void recordedDzChanged(float dz);
+    void recordedDzValidChanged(bool valid);
+
+private slots:
+    void onTimeout();
+
+private:
+    bool loadIndex(qint64 size);
+    bool recordValid(quint64 offset, qint64 size) const;
+    void dispatch(const Session::IndexEntry &entry);
+    qint64 positionNs() const;
+
+    CaptureController *m_captureController;
+    QTimer *m_timer;
+    QFile m_file;
+    const uchar *m_data;
+    QVector<Session::IndexEntry> m_index;
+    qint64 m_start;
+    int m_next;
+    qint64 m_position;
+    QElapsedTimer m_clock;
+    float m_recordedDz;
+    bool m_recordedDzValid;
+    int m_gcodeLine;
+};
+
+#endif // SESSIONPLAYER_H
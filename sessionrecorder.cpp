@@ -0,0 +1,348 @@
+#include "sessionrecorder.h"
+
+#include <QDebug>
+#include <QTimer>
+
+#include <cstring>
+
+#include "capturecontroller.hpp"
+#include "latencystatistics.h"
+
+Q_LOGGING_CATEGORY(session, "vhrd.vision.session")
+
+namespace {
+// Telemetry is tiny, this only guards memory if the writer stalls completely
+enum { MaxPendingEvents = 4096 };
+}
+
+SessionWriter::SessionWriter(SessionRecorder *recorder, QObject *parent) : QObject(parent),
+    m_recorder(recorder)
+{
+}
+
+void SessionWriter::doWork()
+{
+    m_index.clear();
+    while (true) {
+        SessionRecorder::Pending pending;
+        {
+            QMutexLocker lock(&m_recorder->m_queueLock);
+            while (m_recorder->m_queue.isEmpty() && m_recorder->m_recording)
+                m_recorder->m_queueCondition.wait(&m_recorder->m_queueLock);
+            if (m_recorder->m_queue.isEmpty())
+                break;
+            pending = m_recorder->m_queue.dequeue();
+        }
+
+        const quint64 recordOffset = m_recorder->m_file.pos();
+        if (pending.frameBuffer < 0) {
+            if (!writeRecord(pending.type, pending.timestamp, pending.payload.constData(), pending.payload.size())) {
+                fail(recordOffset);
+                return;
+            }
+            continue;
+        }
+
+        // Buffer is owned by the writer until it is put back to free list
+        const cv::Mat &frame = m_recorder->m_buffers[pending.frameBuffer];
+        Session::FramePayload header;
+        header.sequence = pending.info.sequence;
+        header.cameraTimestamp = pending.info.cameraTimestamp;
+        header.rows = frame.rows;
+        header.cols = frame.cols;
+        header.type = frame.type();
+        header.format = static_cast<qint32>(pending.info.format);
+        const bool written = writeRecord(Session::Frame, pending.timestamp, reinterpret_cast<const char *>(&header),
+                                         sizeof(header), reinterpret_cast<const char *>(frame.data),
+                                         frame.total() * frame.elemSize());
+        {
+            QMutexLocker lock(&m_recorder->m_queueLock);
+            m_recorder->m_freeBuffers.append(pending.frameBuffer);
+        }
+        if (!written) {
+            fail(recordOffset);
+            return;
+        }
+        m_recorder->m_framesWritten.fetchAndAddRelaxed(1);
+    }
+
+    // Index and footer make opening instant, without them player walks all records
+    QFile &file = m_recorder->m_file;
+    Session::Footer footer;
+    footer.indexOffset = file.pos();
+    footer.count = m_index.size();
+    memcpy(footer.magic, Session::indexMagic, sizeof(footer.magic));
+    const qint64 indexSize = m_index.size() * sizeof(Session::IndexEntry);
+    if (file.write(reinterpret_cast<const char *>(m_index.constData()), indexSize) != indexSize ||
+            file.write(reinterpret_cast<const char *>(&footer), sizeof(footer)) != qint64(sizeof(footer)) ||
+            !file.flush()) {
+        // Records are complete, player rebuilds the index by walking them
+        qCWarning(session) << "Can't write index" << file.errorString();
+        file.resize(footer.indexOffset);
+    }
+    file.close();
+}
+
+void SessionWriter::fail(quint64 truncateAt)
+{
+    QFile &file = m_recorder->m_file;
+    const QString error = file.errorString();
+    qCWarning(session) << "Can't write" << file.fileName() << error << ", recording stopped";
+    {
+        // Nothing more is accepted, queued frames give their buffers back
+        QMutexLocker lock(&m_recorder->m_queueLock);
+        m_recorder->m_recording = false;
+        foreach (const SessionRecorder::Pending &pending, m_recorder->m_queue) {
+            if (pending.frameBuffer >= 0)
+                m_recorder->m_freeBuffers.append(pending.frameBuffer);
+        }
+        m_recorder->m_queue.clear();
+    }
+    // Partly written record is cut off, the rest reads as an interrupted recording
+    file.resize(truncateAt);
+    file.close();
+    emit failed(error);
+}
+
+bool SessionWriter::writeRecord(quint32 type, qint64 timestamp, const char *payload, quint32 size,
+                                const char *extra, quint32 extraSize)
+{
+    static const char zeros[8] = {};
+    QFile &file = m_recorder->m_file;
+    Session::IndexEntry entry;
+    entry.timestamp = timestamp;
+    entry.offset = file.pos();
+    entry.type = type;
+    entry.reserved = 0;
+
+    Session::RecordHeader header;
+    header.type = type;
+    header.size = Session::padded(size + extraSize);
+    header.timestamp = timestamp;
+    const qint64 padding = header.size - size - extraSize;
+    if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header)) ||
+            file.write(payload, size) != qint64(size) ||
+            (extra && file.write(extra, extraSize) != qint64(extraSize)) ||
+            (padding > 0 && file.write(zeros, padding) != padding))
+        return false;
+    m_index.append(entry);
+    return true;
+}
+
+SessionRecorder::SessionRecorder(CaptureController *captureController, QObject *parent) : QObject(parent),
+    m_captureController(captureController), m_writer(nullptr), m_frameBuffers(8),
+    m_recording(false), m_lastSequence(0), m_generation(0), m_copiesInFlight(0),
+    m_framesWritten(0), m_framesDropped(0)
+{
+    m_countersTimer = new QTimer(this);
+    m_countersTimer->setInterval(1000);
+    connect(m_countersTimer, &QTimer::timeout,
+            this,            &SessionRecorder::countersChanged);
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    stop();
+}
+
+bool SessionRecorder::recording() const
+{
+    return m_writer != nullptr;
+}
+
+int SessionRecorder::frameBuffers() const
+{
+    return m_frameBuffers;
+}
+
+void SessionRecorder::setFrameBuffers(int frameBuffers)
+{
+    m_frameBuffers = qMax(1, frameBuffers);
+}
+
+quint32 SessionRecorder::framesWritten() const
+{
+    return m_framesWritten.load();
+}
+
+quint32 SessionRecorder::framesDropped() const
+{
+    return m_framesDropped.load();
+}
+
+bool SessionRecorder::start(const QString &filename)
+{
+    if (m_writer)
+        stop();
+    m_file.setFileName(filename);
+    // Unbuffered, so a failed write is seen at the record it belongs to and not at some later flush
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate | QFile::Unbuffered)) {
+        qCWarning(session) << "Can't open" << filename << m_file.errorString();
+        return false;
+    }
+    Session::FileHeader header;
+    memcpy(header.magic, Session::fileMagic, sizeof(header.magic));
+    header.version = Session::version;
+    header.reserved = 0;
+    header.startTimestamp = LatencyStatistics::now();
+    if (m_file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != qint64(sizeof(header))) {
+        qCWarning(session) << "Can't write" << filename << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    {
+        QMutexLocker lock(&m_queueLock);
+        // Buffers can't be reallocated or handed out again while a frame is copied into one
+        while (m_copiesInFlight > 0)
+            m_copiesCondition.wait(&m_queueLock);
+        m_generation++;
+        m_queue.clear();
+        m_buffers.resize(m_frameBuffers);
+        m_freeBuffers.clear();
+        for (int i = 0; i < m_frameBuffers; ++i)
+            m_freeBuffers.append(i);
+        m_lastSequence = 0;
+        m_recording = true;
+    }
+    m_framesWritten = 0;
+    m_framesDropped = 0;
+
+    m_writer = new SessionWriter(this);
+    m_writer->moveToThread(&m_writerThread);
+    connect(&m_writerThread, &QThread::started, m_writer, &SessionWriter::doWork);
+    connect(m_writer, &SessionWriter::failed,
+            this,     &SessionRecorder::onWriterFailed);
+    m_writerThread.start();
+    m_countersTimer->start();
+    qCDebug(session) << "Recording to" << filename;
+    emit recordingChanged();
+    emit countersChanged();
+    return true;
+}
+
+void SessionRecorder::stop()
+{
+    if (!m_writer)
+        return;
+    {
+        QMutexLocker lock(&m_queueLock);
+        m_recording = false;
+        m_generation++;
+        m_queueCondition.wakeAll();
+    }
+    // Writer drains the queue and writes index before it quits
+    m_writerThread.quit();
+    m_writerThread.wait();
+    delete m_writer;
+    m_writer = nullptr;
+    m_countersTimer->stop();
+    qCDebug(session) << "Recording stopped, frames written:" << m_framesWritten.load()
+                     << "dropped:" << m_framesDropped.load();
+    emit recordingChanged();
+    emit countersChanged();
+}
+
+void SessionRecorder::onWriterFailed(const QString &error)
+{
+    // Writer has closed the file already, only its thread is left to stop
+    stop();
+    emit failed(error);
+}
+
+void SessionRecorder::onFrameReady()
+{
+    FrameRef frame = m_captureController->latestFrame();
+    if (frame.isNull())
+        return;
+
+    int index;
+    quint32 generation;
+    {
+        QMutexLocker lock(&m_queueLock);
+        if (!m_recording || frame.sequence() == m_lastSequence)
+            return;
+        m_lastSequence = frame.sequence();
+        if (m_freeBuffers.isEmpty()) {
+            m_framesDropped.fetchAndAddRelaxed(1);
+            return;
+        }
+        index = m_freeBuffers.takeLast();
+        generation = m_generation;
+        m_copiesInFlight++;
+    }
+
+    // Buffer taken from free list belongs to this thread until queued, start() waits for it
+    frame.mat().copyTo(m_buffers[index]);
+    Pending pending;
+    pending.type = Session::Frame;
+    pending.timestamp = frame.timestamp();
+    pending.frameBuffer = index;
+    pending.info = frame.info();
+    frame.reset();
+
+    QMutexLocker lock(&m_queueLock);
+    if (--m_copiesInFlight == 0)
+        m_copiesCondition.wakeAll();
+    // Session was stopped or restarted meanwhile, next start() rebuilds the free list
+    if (generation != m_generation || !m_recording)
+        return;
+    m_queue.enqueue(pending);
+    m_queueCondition.wakeOne();
+}
+
+void SessionRecorder::onCoordsChanged(float x, float y, float z, float b)
+{
+    const float coords[4] = {x, y, z, b};
+    enqueue(Session::Coords, QByteArray(reinterpret_cast<const char *>(coords), sizeof(coords)));
+}
+
+void SessionRecorder::onRayStateChanged(int state)
+{
+    enqueueValue<qint32>(Session::RayState, state);
+}
+
+void SessionRecorder::onGcodeLineChanged(int line)
+{
+    enqueueValue<qint32>(Session::GcodeLine, line);
+}
+
+void SessionRecorder::onGcodeStateChanged(int state)
+{
+    enqueueValue<qint32>(Session::GcodeState, state);
+}
+
+void SessionRecorder::onDzChanged(float dz)
+{
+    enqueueValue<float>(Session::Dz, dz);
+}
+
+void SessionRecorder::onDzValidChanged(bool valid)
+{
+    enqueueValue<qint32>(Session::DzValid, valid ? 1 : 0);
+}
+
+void SessionRecorder::enqueue(quint32 type, const QByteArray &payload)
+{
+    Pending pending;
+    pending.type = type;
+    pending.timestamp = LatencyStatistics::now();
+    pending.payload = payload;
+    pending.frameBuffer = -1;
+
+    QMutexLocker lock(&m_queueLock);
+    if (!m_recording)
+        return;
+    if (m_queue.size() >= MaxPendingEvents + m_buffers.size()) {
+        qCWarning(session) << "Writer is stalled, dropping event" << type;
+        return;
+    }
+    m_queue.enqueue(pending);
+    m_queueCondition.wakeOne();
+}
+
+template <typename T>
+void SessionRecorder::enqueueValue(quint32 type, const T &value)
+{
+    enqueue(type, QByteArray(reinterpret_cast<const char *>(&value), sizeof(value)));
+}
@@ -0,0 +1,204 @@
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QFile>
+#include <QQueue>
+#include <QVector>
+#include <QLoggingCategory>
+
+#include <opencv2/core.hpp>
+
+#include "framepool.h"
+
+class CaptureController;
+class SessionRecorder;
+class QTimer;
+
+/**
+ * Session file layout, all integers little endian, every structure starts at 8 byte aligned offset:
+ * FileHeader, then records (RecordHeader + payload padded to 8 bytes) in order they were written,
+ * then on clean close Index entries for every record followed by Footer. A file without Footer
+ * (crash, power loss) is still readable, index is rebuilt by walking the records.
+ * Frame pixels are stored raw right after FramePayload, so they can be used straight from mapped memory.
+ */
+namespace Session {
+
+enum RecordType : quint32 {
+    Frame = 1,   ///< FramePayload + pixels
+    Coords,      ///< 4 floats, x y z b
+    RayState,    ///< qint32 RayReceiver::State
+    GcodeLine,   ///< qint32 line number
+    GcodeState,  ///< qint32 GcodePlayer::State
+    Dz,          ///< float
+    DzValid      ///< qint32 0 or 1
+};
+
+struct FileHeader {
+    char magic[8];          ///< "CNCVSES1"
+    quint32 version;
+    quint32 reserved;
+    qint64 startTimestamp;  ///< LatencyStatistics::now() when recording started
+};
+
+struct RecordHeader {
+    quint32 type;
+    quint32 size;           ///< Payload size including padding
+    qint64 timestamp;       ///< LatencyStatistics::now(), grab time for frames
+};
+
+struct FramePayload {
+    quint64 sequence;
+    double cameraTimestamp;
+    qint32 rows;
+    qint32 cols;
+    qint32 type;            ///< cv::Mat::type(), pixels are continuous
+    qint32 format;          ///< PixelFormat
+};
+
+struct IndexEntry {
+    qint64 timestamp;
+    quint64 offset;         ///< Of RecordHeader
+    quint32 type;
+    quint32 reserved;
+};
+
+struct Footer {
+    quint64 indexOffset;
+    quint64 count;
+    char magic[8];          ///< "CNCVIDX1"
+};
+
+static const char fileMagic[8] = {'C', 'N', 'C', 'V', 'S', 'E', 'S', '1'};
+static const char indexMagic[8] = {'C', 'N', 'C', 'V', 'I', 'D', 'X', '1'};
+static const quint32 version = 1;
+
+inline quint32 padded(quint32 size)
+{
+    return (size + 7) & ~7u;
+}
+
+} // namespace Session
+
+class SessionWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SessionWriter(SessionRecorder *recorder, QObject *parent = nullptr);
+
+signals:
+    /**
+     * @brief failed Write failed, recording is stopped, file keeps records written completely before
+     */
+    void failed(const QString &error);
+
+public slots:
+    void doWork();
+
+private:
+    bool writeRecord(quint32 type, qint64 timestamp, const char *payload, quint32 size,
+                     const char *extra = nullptr, quint32 extraSize = 0);
+    void fail(quint64 truncateAt);
+
+    SessionRecorder *m_recorder;
+    QVector<Session::IndexEntry> m_index;
+};
+
+/**
+ * @brief The SessionRecorder class Records frames, machine telemetry and dz into one session file
+ * Events are queued with timestamps by the slots below and written by a separate thread. Frames are
+ * copied into a bounded set of buffers, when the writer falls behind new frames are dropped and
+ * counted instead of blocking capture.
+ */
+class SessionRecorder : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged)
+    Q_PROPERTY(int frameBuffers READ frameBuffers WRITE setFrameBuffers)
+    Q_PROPERTY(quint32 framesWritten READ framesWritten NOTIFY countersChanged)
+    Q_PROPERTY(quint32 framesDropped READ framesDropped NOTIFY countersChanged)
+public:
+    explicit SessionRecorder(CaptureController *captureController, QObject *parent = nullptr);
+    ~SessionRecorder();
+
+    bool recording() const;
+
+    /**
+     * @brief frameBuffers Frames that can wait for the writer, applied on next start()
+     */
+    int frameBuffers() const;
+    void setFrameBuffers(int frameBuffers);
+
+    quint32 framesWritten() const;
+    quint32 framesDropped() const;
+
+    Q_INVOKABLE bool start(const QString &filename);
+    Q_INVOKABLE void stop();
+
+signals:
+    void recordingChanged();
+    void countersChanged();
+    /**
+     * @brief failed Recording stopped because file couldn't be written, e.g. disk is full
+     */
+    void failed(const QString &error);
+
+public slots:
+    /**
+     * @brief onFrameReady Copies current frame into a free buffer, thread safe
+     * Connect with Qt::DirectConnection, so frames are not queued in the event loop.
+     */
+    void onFrameReady();
+    void onCoordsChanged(float x, float y, float z, float b);
+    void onRayStateChanged(int state);
+    void onGcodeLineChanged(int line);
+    void onGcodeStateChanged(int state);
+    void onDzChanged(float dz);
+    void onDzValidChanged(bool valid);
+
+private slots:
+    void onWriterFailed(const QString &error);
+
+private:
+    friend class SessionWriter;
+    struct Pending {
+        quint32 type;
+        qint64 timestamp;
+        QByteArray payload;
+        int frameBuffer;
+        FrameInfo info;
+    };
+    void enqueue(quint32 type, const QByteArray &payload);
+    template <typename T>
+    void enqueueValue(quint32 type, const T &value);
+
+    CaptureController *m_captureController;
+    QThread m_writerThread;
+    SessionWriter *m_writer;
+    QTimer *m_countersTimer;
+    QFile m_file;
+    int m_frameBuffers;
+
+    QMutex m_queueLock;
+    QWaitCondition m_queueCondition;
+    QQueue<Pending> m_queue;
+    QVector<cv::Mat> m_buffers;
+    QVector<int> m_freeBuffers;
+    bool m_recording;
+    quint64 m_lastSequence;
+    quint32 m_generation;       ///< Changed by start() and stop(), frames copied for an older session are dropped
+    int m_copiesInFlight;       ///< Buffers taken by onFrameReady() and not queued yet
+    QWaitCondition m_copiesCondition;
+
+    QAtomicInteger<quint32> m_framesWritten;
+    QAtomicInteger<quint32> m_framesDropped;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(session)
+
+#endif // SESSIONRECORDER_H
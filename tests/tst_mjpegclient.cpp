@@ -0,0 +1,274 @@
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+
+#include <thread>
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "mjpegclient.h"
+
+/**
+ * @brief The StreamServer class Serves one HTTP connection with a prepared multipart body from its own thread
+ * MjpegClient blocks in the test thread, so the server can't share its event loop.
+ * Body is written in pieces ending at splits, with a pause after each, so the client sees them in separate reads.
+ */
+class StreamServer : public QThread
+{
+public:
+    StreamServer(const QByteArray &boundary, const QByteArray &body, const QList<int> &splits = QList<int>(),
+                 bool closeAfterSend = true) :
+        m_boundary(boundary), m_body(body), m_splits(splits), m_closeAfterSend(closeAfterSend), m_port(0)
+    {
+        start();
+        m_ready.acquire();
+    }
+    ~StreamServer()
+    {
+        wait();
+    }
+
+    QUrl url() const
+    {
+        return QUrl(QString("http://127.0.0.1:%1/?action=stream").arg(m_port));
+    }
+
+protected:
+    void run() override
+    {
+        QTcpServer server;
+        server.listen(QHostAddress::LocalHost);
+        m_port = server.serverPort();
+        m_ready.release();
+        if (!server.waitForNewConnection(5000))
+            return;
+        QTcpSocket *socket = server.nextPendingConnection();
+        QByteArray request;
+        while (!request.contains("\r\n\r\n") && socket->waitForReadyRead(5000))
+            request += socket->readAll();
+
+        send(socket, "HTTP/1.0 200 OK\r\nContent-Type: multipart/x-mixed-replace; boundary=" + m_boundary + "\r\n\r\n");
+        int from = 0;
+        foreach (int split, m_splits) {
+            send(socket, m_body.mid(from, split - from));
+            msleep(50);
+            from = split;
+        }
+        send(socket, m_body.mid(from));
+
+        // Stalled stream is left open until the client goes away
+        if (m_closeAfterSend)
+            socket->disconnectFromHost();
+        if (socket->state() != QAbstractSocket::UnconnectedState)
+            socket->waitForDisconnected(10000);
+        delete socket;
+    }
+
+private:
+    static void send(QTcpSocket *socket, const QByteArray &data)
+    {
+        socket->write(data);
+        while (socket->bytesToWrite() > 0 && socket->waitForBytesWritten(5000)) {
+        }
+    }
+
+    QByteArray m_boundary;
+    QByteArray m_body;
+    QList<int> m_splits;
+    bool m_closeAfterSend;
+    quint16 m_port;
+    QSemaphore m_ready;
+};
+
+class TestMjpegClient : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void readsFrames_data();
+    void readsFrames();
+    void boundarySplitAcrossReads_data();
+    void boundarySplitAcrossReads();
+    void skipsPartOverLimitWithLength();
+    void skipsPartOverLimitWithoutLength();
+    void cancelStopsBlockedRead();
+    void readsRecording();
+
+private:
+    static QByteArray part(const QByteArray &jpeg, bool withLength);
+    static QByteArray body(const QList<QByteArray> &parts);
+    static QList<int> markerSplits(const QByteArray &body);
+    void readAll(const QUrl &url, const QList<QByteArray> &expected);
+
+    QList<QByteArray> m_jpegs;
+};
+
+void TestMjpegClient::initTestCase()
+{
+    for (int i = 0; i < 3; ++i) {
+        cv::Mat image(48, 64, CV_8UC3);
+        for (int row = 0; row < image.rows; ++row)
+            image.row(row).setTo(cv::Scalar(row * 5, i * 80, 255 - row * 5));
+        std::vector<uchar> encoded;
+        QVERIFY(cv::imencode(".jpg", image, encoded));
+        m_jpegs.append(QByteArray(reinterpret_cast<const char *>(encoded.data()), int(encoded.size())));
+    }
+}
+
+QByteArray TestMjpegClient::part(const QByteArray &jpeg, bool withLength)
+{
+    QByteArray p = "--frame\r\nContent-Type: image/jpeg\r\n";
+    if (withLength)
+        p += "Content-Length: " + QByteArray::number(jpeg.size()) + "\r\n";
+    return p + "\r\n" + jpeg + "\r\n";
+}
+
+QByteArray TestMjpegClient::body(const QList<QByteArray> &parts)
+{
+    QByteArray b;
+    foreach (const QByteArray &p, parts)
+        b += p;
+    // Last part without length ends at the closing boundary
+    return b + "--frame--\r\n";
+}
+
+QList<int> TestMjpegClient::markerSplits(const QByteArray &body)
+{
+    // Middle of every "\r\n--frame", the part a client without Content-Length searches for
+    QList<int> splits;
+    for (int i = body.indexOf("\r\n--frame"); i >= 0; i = body.indexOf("\r\n--frame", i + 1))
+        splits.append(i + 4);
+    return splits;
+}
+
+void TestMjpegClient::readAll(const QUrl &url, const QList<QByteArray> &expected)
+{
+    MjpegClient client;
+    QVERIFY2(client.open(url), qPrintable(client.errorString()));
+    QByteArray jpeg;
+    foreach (const QByteArray &e, expected) {
+        QVERIFY2(client.readFrame(jpeg), qPrintable(client.errorString()));
+        QCOMPARE(jpeg, e);
+        if (e.isEmpty())
+            continue;
+        cv::Mat frame;
+        QVERIFY(MjpegClient::decode(jpeg, frame, 1, QRectF()));
+        QCOMPARE(frame.cols, 64);
+        QCOMPARE(frame.rows, 48);
+        QVERIFY(MjpegClient::decode(jpeg, frame, 2, QRectF(0.5, 0.5, 0.5, 0.5), true));
+        QCOMPARE(frame.cols, 16);
+        QCOMPARE(frame.rows, 12);
+        QCOMPARE(frame.channels(), 1);
+    }
+    QVERIFY(!client.readFrame(jpeg));
+}
+
+void TestMjpegClient::readsFrames_data()
+{
+    QTest::addColumn<bool>("withLength");
+    QTest::newRow("Content-Length") << true;
+    QTest::newRow("no Content-Length") << false;
+}
+
+void TestMjpegClient::readsFrames()
+{
+    QFETCH(bool, withLength);
+    QList<QByteArray> parts;
+    foreach (const QByteArray &jpeg, m_jpegs)
+        parts.append(part(jpeg, withLength));
+    StreamServer server("frame", body(parts));
+    readAll(server.url(), m_jpegs);
+}
+
+void TestMjpegClient::boundarySplitAcrossReads_data()
+{
+    readsFrames_data();
+}
+
+void TestMjpegClient::boundarySplitAcrossReads()
+{
+    QFETCH(bool, withLength);
+    QList<QByteArray> parts;
+    foreach (const QByteArray &jpeg, m_jpegs)
+        parts.append(part(jpeg, withLength));
+    const QByteArray b = body(parts);
+    StreamServer server("frame", b, markerSplits(b));
+    readAll(server.url(), m_jpegs);
+}
+
+void TestMjpegClient::skipsPartOverLimitWithLength()
+{
+    // Declared length is over the limit, the client must not trust it and resynchronizes on the boundary
+    QByteArray broken = "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: 9000000\r\n\r\n" +
+                        QByteArray(100, 'x') + "\r\n";
+    StreamServer server("frame", body(QList<QByteArray>() << part(m_jpegs[0], true) << broken
+                                                          << part(m_jpegs[1], true)));
+    readAll(server.url(), QList<QByteArray>() << m_jpegs[0] << QByteArray() << m_jpegs[1]);
+}
+
+void TestMjpegClient::skipsPartOverLimitWithoutLength()
+{
+    QByteArray broken = part(QByteArray(9 * 1024 * 1024, 'x'), false);
+    const QByteArray b = body(QList<QByteArray>() << part(m_jpegs[0], false) << broken << part(m_jpegs[1], false));
+    StreamServer server("frame", b, markerSplits(b));
+    readAll(server.url(), QList<QByteArray>() << m_jpegs[0] << QByteArray() << m_jpegs[1]);
+}
+
+void TestMjpegClient::cancelStopsBlockedRead()
+{
+    // Stream stalls after the first frame, CaptureController::stop() cancels the read from another thread
+    StreamServer server("frame", part(m_jpegs[0], true), QList<int>(), false);
+    MjpegClient client;
+    QVERIFY2(client.open(server.url()), qPrintable(client.errorString()));
+    QByteArray jpeg;
+    QVERIFY(client.readFrame(jpeg));
+
+    std::thread canceller([&client]() {
+        QThread::msleep(200);
+        client.cancel();
+    });
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY(!client.readFrame(jpeg));
+    canceller.join();
+    QVERIFY(timer.elapsed() < 1000);
+    client.close();
+}
+
+void TestMjpegClient::readsRecording()
+{
+    // Raw stream body saved from a camera, e.g. curl -o stream.mjpg http://camera:8080/?action=stream
+    const QString filename = QString::fromLocal8Bit(qgetenv("MJPEG_RECORDING"));
+    if (filename.isEmpty())
+        QSKIP("Set MJPEG_RECORDING to a recorded stream to play it");
+    QFile file(filename);
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray recording = file.readAll();
+    const int start = recording.indexOf("--");
+    QVERIFY(start >= 0);
+    QByteArray boundary = recording.mid(start + 2, recording.indexOf("\r\n", start) - start - 2);
+    StreamServer server(boundary, recording.mid(start));
+
+    MjpegClient client;
+    QVERIFY2(client.open(server.url()), qPrintable(client.errorString()));
+    QByteArray jpeg;
+    int frames = 0;
+    while (client.readFrame(jpeg)) {
+        if (jpeg.isEmpty())
+            continue; // part over the limit
+        cv::Mat frame;
+        QVERIFY(MjpegClient::decode(jpeg, frame, 1, QRectF()));
+        frames++;
+    }
+    QVERIFY(frames > 0);
+    qDebug() << frames << "frames in" << filename;
+}
+
+QTEST_GUILESS_MAIN(TestMjpegClient)
+
+#include "tst_mjpegclient.moc"
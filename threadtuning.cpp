@@ -0,0 +1,198 @@
+#include "threadtuning.h"
+
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+Q_LOGGING_CATEGORY(threadTuning, "vhrd.vision.threads")
+
+namespace {
+
+QByteArray variable(const QString &role, const char *name)
+{
+    return qgetenv(QString("VHRD_VISION_%1_%2").arg(role.toUpper()).arg(name).toLatin1());
+}
+
+QVector<int> parseCpus(const QByteArray &value, bool &ok)
+{
+    QVector<int> cpus;
+    ok = true;
+    foreach (const QByteArray &part, value.split(',')) {
+        QList<QByteArray> range = part.trimmed().split('-');
+        bool fromOk = false, toOk = true;
+        int from = range.value(0).toInt(&fromOk);
+        int to = range.size() > 1 ? range.value(1).toInt(&toOk) : from;
+        if (!fromOk || (range.size() > 1 && !toOk) || range.size() > 2 || from < 0 || to < from) {
+            ok = false;
+            continue;
+        }
+        for (int cpu = from; cpu <= to; ++cpu) {
+            if (!cpus.contains(cpu))
+                cpus.append(cpu);
+        }
+    }
+    return cpus;
+}
+
+#ifdef Q_OS_LINUX
+int nativePolicy(ThreadTuning::Policy policy)
+{
+    switch (policy) {
+    case ThreadTuning::Fifo:
+        return SCHED_FIFO;
+    case ThreadTuning::RoundRobin:
+        return SCHED_RR;
+    default:
+        return SCHED_OTHER;
+    }
+}
+
+bool realtimeAllowed(int priority)
+{
+    if (geteuid() == 0)
+        return true;
+    struct rlimit limit;
+    // CAP_SYS_NICE isn't checked, it is rare outside of root and apply() tells anyway
+    return getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+            (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= rlim_t(priority));
+}
+#endif
+
+} // namespace
+
+ThreadTuning::Settings ThreadTuning::configured(const QString &role)
+{
+    Settings s;
+    QByteArray cpus = variable(role, "CPUS");
+    if (!cpus.isEmpty()) {
+        bool ok;
+        s.cpus = parseCpus(cpus, ok);
+        if (!ok)
+            qCWarning(threadTuning) << role << "has invalid cpu list" << cpus;
+    }
+
+    QByteArray policy = variable(role, "POLICY").trimmed().toLower();
+    if (policy == "fifo")
+        s.policy = Fifo;
+    else if (policy == "rr")
+        s.policy = RoundRobin;
+    else if (!policy.isEmpty() && policy != "other")
+        qCWarning(threadTuning) << role << "has unknown scheduling policy" << policy;
+
+    if (s.policy != Other) {
+        bool ok;
+        s.priority = variable(role, "PRIORITY").toInt(&ok);
+        if (!ok)
+            s.priority = 50;
+#ifdef Q_OS_LINUX
+        const int native = nativePolicy(s.policy);
+        s.priority = qBound(sched_get_priority_min(native), s.priority, sched_get_priority_max(native));
+#endif
+    }
+    return s;
+}
+
+ThreadTuning::Settings ThreadTuning::current()
+{
+    Settings s;
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0 && CPU_COUNT(&set) < QThread::idealThreadCount()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set))
+                s.cpus.append(cpu);
+        }
+    }
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        s.policy = policy == SCHED_FIFO ? Fifo : policy == SCHED_RR ? RoundRobin : Other;
+        s.priority = s.policy == Other ? 0 : param.sched_priority;
+    }
+#endif
+    return s;
+}
+
+bool ThreadTuning::apply(const QString &role)
+{
+    const Settings s = configured(role);
+    if (s.cpus.isEmpty() && s.policy == Other)
+        return true;
+#ifdef Q_OS_LINUX
+    bool ok = true;
+    if (!s.cpus.isEmpty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        foreach (int cpu, s.cpus) {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0) {
+            qCWarning(threadTuning) << role << "can't be pinned to cpus" << s.cpus << strerror(error);
+            ok = false;
+        }
+    }
+    if (s.policy != Other) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = s.priority;
+        int error = pthread_setschedparam(pthread_self(), nativePolicy(s.policy), &param);
+        if (error != 0) {
+            qCWarning(threadTuning) << role << "stays with default scheduler, can't switch to"
+                                    << toString(s) << strerror(error);
+            ok = false;
+        }
+    }
+    qCInfo(threadTuning) << role << "thread runs with" << toString(current());
+    return ok;
+#else
+    qCWarning(threadTuning) << role << "thread tuning is only supported on Linux";
+    return false;
+#endif
+}
+
+void ThreadTuning::report(const QStringList &roles)
+{
+    foreach (const QString &role, roles) {
+        const Settings s = configured(role);
+        if (s.cpus.isEmpty() && s.policy == Other) {
+            qCInfo(threadTuning) << role << "default scheduling";
+            continue;
+        }
+        QString note;
+        foreach (int cpu, s.cpus) {
+            if (cpu >= QThread::idealThreadCount())
+                note += QString(", cpu %1 doesn't exist").arg(cpu);
+        }
+#ifdef Q_OS_LINUX
+        if (s.policy != Other && !realtimeAllowed(s.priority))
+            note += ", no privilege for real-time priority, will fall back to default scheduler";
+#else
+        note += ", not supported on this platform";
+#endif
+        qCInfo(threadTuning).noquote() << role << toString(s) + note;
+    }
+}
+
+QString ThreadTuning::toString(const ThreadTuning::Settings &settings)
+{
+    QStringList cpus;
+    foreach (int cpu, settings.cpus)
+        cpus.append(QString::number(cpu));
+    QString result = QString("cpus %1").arg(cpus.isEmpty() ? QString("any") : cpus.join(','));
+    if (settings.policy == Fifo)
+        result += QString(", fifo %1").arg(settings.priority);
+    else if (settings.policy == RoundRobin)
+        result += QString(", rr %1").arg(settings.priority);
+    else
+        result += ", other";
+    return result;
+}
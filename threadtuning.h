@@ -0,0 +1,58 @@
+#ifndef THREADTUNING_H
+#define THREADTUNING_H
+
+#include <QLoggingCategory>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Pins pipeline threads to cores and gives them real-time priority, configured per thread role
+ * from environment, nothing is changed for roles without configuration:
+ *   VHRD_VISION_<ROLE>_CPUS      cores, e.g. "3" or "2,3" or "2-3"
+ *   VHRD_VISION_<ROLE>_POLICY    "other" (default), "fifo" or "rr"
+ *   VHRD_VISION_<ROLE>_PRIORITY  1..99 for fifo and rr, 50 if not set
+ * Roles are "detector" and "capture_<name>" for every CaptureController, e.g. VHRD_VISION_CAPTURE_MAIN_CPUS.
+ * Real-time policies need root, CAP_SYS_NICE or RLIMIT_RTPRIO (ulimit -r), without them thread stays
+ * with the default scheduler and a warning is printed. Linux only.
+ */
+namespace ThreadTuning {
+
+enum Policy {
+    Other,     ///< SCHED_OTHER, default time sharing
+    Fifo,      ///< SCHED_FIFO
+    RoundRobin ///< SCHED_RR
+};
+
+struct Settings {
+    Settings() : policy(Other), priority(0) {}
+    QVector<int> cpus; ///< Empty for any core
+    Policy policy;
+    int priority;      ///< Only for Fifo and RoundRobin
+};
+
+/**
+ * @brief configured Settings of role read from environment
+ */
+Settings configured(const QString &role);
+/**
+ * @brief current Effective settings of calling thread
+ */
+Settings current();
+/**
+ * @brief apply Applies configured settings of role to calling thread and logs effective ones
+ * @return false if some setting couldn't be applied, thread keeps running with the rest
+ */
+bool apply(const QString &role);
+/**
+ * @brief report Logs configuration of roles and whether it can be applied, call once at startup
+ */
+void report(const QStringList &roles);
+
+QString toString(const Settings &settings);
+
+} // namespace ThreadTuning
+
+Q_DECLARE_LOGGING_CATEGORY(threadTuning)
+
+#endif // THREADTUNING_H